@@ -0,0 +1,116 @@
+#! /usr/bin/python3
+
+# Runs every workload in bench/ through ./main and its hand-written C twin.
+# Reports the ops it executes per second, the wall time of every phase and
+# how far it is from the native version and from bench/baseline.json.
+#   ./bench.py [save] [options for main...]
+# `save` records the results as the new baseline.
+
+import glob
+import json
+import os
+import subprocess
+import sys
+import time
+
+concat = "./main"
+baseline_file = "./bench/baseline.json"
+runs = 3 # the fastest one counts
+
+def count_ops(filename):
+    # Ops of the unoptimized program, the same for any engine or optimizer.
+    run_output = subprocess.run(
+            [concat, filename, "--no-opt", "--seq-profile"],
+            stderr=subprocess.PIPE,
+            stdout=subprocess.DEVNULL,
+            check=True,
+            text=True)
+    for line in run_output.stderr.splitlines():
+        if line.startswith("> Sequence profile:"):
+            return int(line.split()[3])
+    return 0
+
+def time_concat(filename, options):
+    best = None
+    for _ in range(runs):
+        run_output = subprocess.run(
+                [concat, filename, "--time"] + options,
+                stderr=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                check=True,
+                text=True)
+        phases = {}
+        for line in run_output.stderr.splitlines():
+            if line.startswith("phase "):
+                _, name, ms, _ = line.split()
+                phases[name] = float(ms)
+        if best is None or phases["run"] < best["run"]:
+            best = phases
+    return best, run_output.stdout
+
+def time_native(filename):
+    exe = "/tmp/concat_bench_" + os.path.basename(filename)[:-2]
+    subprocess.run(["cc", "-O2", "-o", exe, filename], check=True)
+    best = None
+    for _ in range(runs):
+        start = time.perf_counter()
+        run_output = subprocess.run(
+                [exe],
+                stderr=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                check=True,
+                text=True)
+        ms = (time.perf_counter() - start) * 1e3
+        if best is None or ms < best:
+            best = ms
+    return best, run_output.stdout
+
+def run_bench(filename, options, baseline):
+    name = os.path.basename(filename)[:-3]
+    ops = count_ops(filename)
+    phases, output = time_concat(filename, options)
+    mops = ops / phases["run"] / 1e3
+    line = f"{name:10} {ops / 1e6:8.1f}M ops {phases['run']:9.1f} ms {mops:8.1f} Mops/s"
+
+    native = filename[:-3] + ".c"
+    native_ms = None
+    if os.path.exists(native):
+        native_ms, native_output = time_native(native)
+        line += f"   native {native_ms:7.1f} ms {phases['run'] / native_ms:6.1f}x"
+        if native_output != output:
+            line += " \u001b[31m(output differs)\u001b[0m"
+
+    if name in baseline:
+        before = baseline[name]["mops"]
+        line += f"   baseline {before:8.1f} Mops/s {(mops / before - 1) * 100:+6.1f}%"
+    print(line)
+    print("           " + " ".join(f"{phase} {ms:.3f}" for phase, ms in phases.items()) + " ms")
+    if native_ms is not None:
+        native_ms = round(native_ms, 3)
+    return {"ops": ops, "mops": round(mops, 1), "phases": phases, "native_ms": native_ms}
+
+
+if __name__ == "__main__":
+    if not os.path.exists(concat):
+        print("Compile concat before running benchmarks\n")
+        sys.exit(1)
+
+    options = sys.argv[1:]
+    save = len(options) > 0 and options[0] == "save"
+    if save:
+        options = options[1:]
+
+    baseline = {}
+    if os.path.exists(baseline_file):
+        baseline = json.load(open(baseline_file))
+
+    print(f"Running all benchmarks {' '.join(options)}:")
+    results = {}
+    for filename in sorted(glob.glob("./bench/*.cc")):
+        results[os.path.basename(filename)[:-3]] = run_bench(filename, options, baseline)
+
+    if save:
+        with open(baseline_file, "w") as file:
+            json.dump(results, file, indent=4)
+            file.write("\n")
+        print(f"Saved as the baseline in {baseline_file}")
@@ -0,0 +1,9 @@
+#include <stdio.h>
+
+int main(void) {
+    long h = 0;
+    for (long i = 10000000; i > 0; i--)
+        h = (h * 31 + i) % 1000003;
+    printf("%ld\n", h);
+    return 0;
+}
@@ -0,0 +1,6 @@
+// Integer arithmetic in a counted loop, h = (h * 31 + i) % 1000003 for i
+// from 10000000 down to 1.
+0 10000000 loop . 0 < do
+	. 1 <- ; 31 * + 1000003 ; %
+	1 -> 1 ; -
+end , sout 10 putc
@@ -0,0 +1,21 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(void) {
+    long total = 0;
+    char *buf = malloc(4096);
+    for (int i = 20000; i > 0; i--) {
+        int fd = open("./bench/file.cc", O_RDONLY);
+        long size = lseek(fd, 0, SEEK_END);
+        total += size;
+        lseek(fd, 0, SEEK_SET);
+        if (read(fd, buf, size) != size)
+            return 1;
+        close(fd);
+    }
+    free(buf);
+    printf("%ld\n", total);
+    return 0;
+}
@@ -0,0 +1,23 @@
+"./std.cc" include
+
+// File reads through the libc words, opens this file, reads it whole into a
+// buffer and closes it again, 20000 times.
+i64 fd mem
+i64 size mem
+i64 buf mem
+i64 total mem
+
+4096 malloc buf w64_mem
+
+20000 loop . 0 < do
+	O_RONLY "./bench/file.cc" open fd w64_mem
+	SEEK_END 0 i64 fd deref lseek . size w64_mem
+	i64 total deref + total w64_mem
+	SEEK_SET 0 i64 fd deref lseek ,
+	i64 size deref i64 buf deref i64 fd deref read
+	i64 fd deref close
+	1 ; -
+end ,
+
+i64 buf deref free
+i64 total deref sout 10 putc
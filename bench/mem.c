@@ -0,0 +1,10 @@
+#include <stdio.h>
+
+long cells[1000];
+
+int main(void) {
+    for (long i = 3000000; i > 0; i--)
+        cells[i % 1000] += i / 1000;
+    printf("%ld\n%ld\n%ld\n", cells[0], cells[500], cells[999]);
+    return 0;
+}
@@ -0,0 +1,17 @@
+"./std.cc" include
+
+// `mem` loads and stores, adds i / 1000 to cell i % 1000 for i from 3000000
+// down to 1.
+8000 cells mem
+i64 i mem
+
+3000000 i w64_mem
+i64 i deref loop . 0 < do
+	1000 ; % 8 * cells +
+	. i64 ; deref i64 i deref 1000 ; / + ; w64_mem
+	i64 i deref 1 ; - . i w64_mem
+end ,
+
+i64 cells deref sout 10 putc
+i64 cells 4000 + deref sout 10 putc
+i64 cells 7992 + deref sout 10 putc
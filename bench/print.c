@@ -0,0 +1,7 @@
+#include <stdio.h>
+
+int main(void) {
+    for (long i = 500000; i > 0; i--)
+        printf("%ld %s\n", i, "bottles of concat on the wall");
+    return 0;
+}
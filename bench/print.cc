@@ -0,0 +1,5 @@
+// Printing, a number and a string literal per line for 500000 lines.
+500000 loop . 0 < do
+	. sout 32 putc "bottles of concat on the wall" println
+	1 ; -
+end ,
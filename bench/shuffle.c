@@ -0,0 +1,13 @@
+#include <stdio.h>
+
+int main(void) {
+    long a = 0, b = 1, c = 2;
+    for (long i = 5000000; i > 0; i--) {
+        long s = (a + b) % 1000003;
+        a = b;
+        b = c;
+        c = s;
+    }
+    printf("%ld %ld %ld\n", c, b, a);
+    return 0;
+}
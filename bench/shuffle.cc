@@ -0,0 +1,7 @@
+// `<-` and `->` shuffling, (a, b, c) becomes (b, c, (a + b) % 1000003)
+// 5000000 times with the counter parked on the back stack.
+0 1 2 5000000 loop . 0 < do
+	1 <- 1 <- : + 1000003 ; %
+	1 <- ; , 2 -> ; 1 ->
+	1 ; -
+end , sout 32 putc sout 32 putc sout 10 putc
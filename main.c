@@ -1,18 +1,34 @@
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-#include <bench.h>
 #include <io.h>
 #include <strb.h>
 #include <vector.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
 #define _ (void)
 
 #define List(name, type) \
@@ -22,38 +38,117 @@
         int cap;         \
     } name
 
-#ifdef DEBUG
-#define MEASURE(bPtr, strmsg)        \
-    do {                             \
-        BENCH_MEASURE(bPtr, strmsg); \
-    } while (0)
-#else
-#define MEASURE(bPtr, strmsg)
-#endif
+#define FOR_LIST(list) for (int i = 0; i < (list).cnt; i++)
 
 #define KB 1024
+#define MB (1024 * KB)
 
-static char temp_buf[8 * KB] = {0};
-static size_t temp_ptr = 0;
+// :output
+// Where a thread's programs report. Output and errors go to `out`, stdout
+// unless `main --jobs` captures them, and with `fail` set an error unwinds
+// there instead of ending the process.
+#define RUN_MAPS 8
 
-size_t cstr_cpy(void *src, size_t len) {
-    size_t at = temp_ptr;
-    memcpy(temp_buf + temp_ptr, src, len);
-    temp_ptr += len + 1;
-    return at;
+typedef struct {
+    FILE *out;
+    sigjmp_buf *fail;
+    int status;
+    // Mappings the running program holds, release_run unmaps them when it
+    // failed halfway.
+    struct {
+        void *at;
+        size_t len;
+    } maps[RUN_MAPS];
+} RunCtx;
+
+static _Thread_local RunCtx run_ctx;
+
+FILE *run_out(void) {
+    return run_ctx.out != NULL ? run_ctx.out : stdout;
 }
 
-bool str_eq(size_t ptr, const char *to_check) {
-    char *at_temp = temp_buf + ptr;
-    size_t temp_len = strlen(at_temp);
-    size_t to_check_len = strlen(to_check);
-    if (temp_len != to_check_len) {
-        return false;
+// Reports like --stats go to stderr, under --jobs with the rest of the run.
+FILE *report_out(void) {
+    return run_ctx.out != NULL ? run_ctx.out : stderr;
+}
+
+__attribute__((noreturn)) void fail(int status) {
+    if (run_ctx.fail == NULL)
+        exit(status);
+    run_ctx.status = status;
+    siglongjmp(*run_ctx.fail, 1);
+}
+
+void track_map(void *at, size_t len) {
+    for (int i = 0; i < RUN_MAPS; i++) {
+        if (run_ctx.maps[i].at == NULL) {
+            run_ctx.maps[i].at = at;
+            run_ctx.maps[i].len = len;
+            return;
+        }
+    }
+    // Untracked it would leak once the run unwinds.
+    munmap(at, len);
+    fprintf(run_out(), "E: A run can't hold more than %d mappings.\n", RUN_MAPS);
+    fail(1);
+}
+
+void untrack_map(void *at) {
+    for (int i = 0; i < RUN_MAPS; i++) {
+        if (run_ctx.maps[i].at == at)
+            run_ctx.maps[i].at = NULL;
+    }
+}
+// ;output
+
+// :strings
+// Growable arena of length prefixed strings, one per ProgramRun. A reference
+// is the offset of the first byte: the length is stored in the 4 bytes
+// before it and every string is NUL terminated so libc can use it as is.
+// References stay valid when the arena grows.
+typedef struct {
+    char *data;
+    size_t cnt;
+    size_t cap;
+} StrArena;
+
+size_t str_push(StrArena *strs, const char *src, size_t len) {
+    size_t need = strs->cnt + sizeof(uint32_t) + len + 1;
+    if (need > strs->cap) {
+        size_t cap = strs->cap == 0 ? 4 * KB : strs->cap;
+        while (cap < need)
+            cap *= 2;
+        strs->data = realloc(strs->data, cap);
+        strs->cap = cap;
     }
-    return strncmp(at_temp, to_check, to_check_len) == 0;
+
+    uint32_t l = len;
+    memcpy(strs->data + strs->cnt, &l, sizeof(l));
+    size_t at = strs->cnt + sizeof(l);
+    memcpy(strs->data + at, src, len);
+    strs->data[at + len] = 0;
+    strs->cnt = at + len + 1;
+    return at;
+}
+
+size_t str_len(const StrArena *strs, size_t ref) {
+    uint32_t l;
+    memcpy(&l, strs->data + ref - sizeof(l), sizeof(l));
+    return l;
 }
 
-#define CSTR(ptr) temp_buf + (ptr)
+#define CSTR(strs, ref) ((strs)->data + (ref))
+// ;strings
+
+uint64_t hash_bytes(const char *data, size_t len) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
 
 // :tokenizer
 typedef enum {
@@ -90,210 +185,237 @@ typedef struct {
     (Loc) { path, col, row }
 
 void printloc(Loc l) {
-    printf("%s:%d:%d:", l.path, l.row, l.col);
+    fprintf(run_out(), "%s:%d:%d:", l.path, l.row, l.col);
 }
 
 typedef struct {
     TokenType t;
     Loc l;
-    size_t lit_ptr;
+    uint32_t off; // the text is `len` bytes at ProgramRun.code + off
+    uint32_t len;
     int index;
+    int sym;
 } Token;
 
 List(Tokens, Token);
 
-Token make_token(TokenType t, size_t temp_ptr, Loc l, int index) {
-    return (Token){t, l, temp_ptr, index};
+Token make_token(TokenType t, size_t off, size_t len, Loc l, int index) {
+    return (Token){t, l, off, len, index, -1};
 }
 
-size_t tokenize_identifier(char *const code, size_t code_len, size_t cursor) {
-    size_t end = cursor;
-
-    while (end < code_len && (code[end] != ' ' && code[end] != '\n'))
-        end++;
+typedef enum {
+    CC_OTHER = 0,
+    CC_BLANK,
+    CC_NEWLINE,
+    CC_DIGIT,
+    CC_ALPHA,
+    CC_QUOTE,
+    CC_OP, // char_token has the token, `-`, `<` and `/` can start two char ones
+} CharClass;
+
+static const uint8_t char_class[256] = {
+    [' '] = CC_BLANK,
+    ['\t'] = CC_BLANK,
+    ['\n'] = CC_NEWLINE,
+    ['\r'] = CC_NEWLINE,
+    ['0' ... '9'] = CC_DIGIT,
+    ['a' ... 'z'] = CC_ALPHA,
+    ['A' ... 'Z'] = CC_ALPHA,
+    ['"'] = CC_QUOTE,
+    ['+'] = CC_OP,
+    ['-'] = CC_OP,
+    ['*'] = CC_OP,
+    ['/'] = CC_OP,
+    ['%'] = CC_OP,
+    ['<'] = CC_OP,
+    ['>'] = CC_OP,
+    ['='] = CC_OP,
+    ['?'] = CC_OP,
+    ['!'] = CC_OP,
+    ['.'] = CC_OP,
+    [':'] = CC_OP,
+    [','] = CC_OP,
+    [';'] = CC_OP,
+};
+
+static const uint8_t char_token[256] = {
+    ['+'] = TT_PLUS,
+    ['-'] = TT_MINUS,
+    ['*'] = TT_MULT,
+    ['/'] = TT_DIV,
+    ['%'] = TT_MOD,
+    ['<'] = TT_LT,
+    ['>'] = TT_GT,
+    ['='] = TT_EQ,
+    ['?'] = TT_DUMP,
+    ['!'] = TT_BDUMP,
+    ['.'] = TT_DUP,
+    [':'] = TT_2DUP,
+    [','] = TT_DROP,
+    [';'] = TT_SWAP,
+};
+static_assert(TT_COUNT == 19, "Implement newly add TokenType");
 
-    return end;
+// First index from `cursor` that isn't a blank, 16 bytes at a time where
+// SSE2 is around.
+size_t scan_blanks(const char *code, size_t len, size_t cursor) {
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    while (cursor + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(code + cursor));
+        int blank = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)));
+        if (blank != 0xffff)
+            return cursor + __builtin_ctz(~blank);
+        cursor += 16;
+    }
+#endif
+    while (cursor < len && char_class[(unsigned char)code[cursor]] == CC_BLANK)
+        cursor++;
+    return cursor;
 }
 
-size_t tokenize_str_literal(char *const code, size_t len, size_t cursor) {
-    size_t end = ++cursor;
-
-    while (end < len && code[end] != '"')
-        end++;
-
-    return end + 1;
+// Identifiers run up to the next space or newline, whatever is in between.
+size_t scan_identifier(const char *code, size_t len, size_t cursor) {
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (cursor + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(code + cursor));
+        int end = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, newline)));
+        if (end != 0)
+            return cursor + __builtin_ctz(end);
+        cursor += 16;
+    }
+#endif
+    while (cursor < len && code[cursor] != ' ' && code[cursor] != '\n')
+        cursor++;
+    return cursor;
 }
 
-size_t tokenize_number_literal(char *const code, size_t len, size_t cursor) {
-    size_t end = cursor;
-
-    while (end < len && isdigit(code[end]) && (code[end] != ' ' && code[end] != '\n'))
-        end++;
-
-    return end;
+size_t scan_digits(const char *code, size_t len, size_t cursor) {
+    while (cursor < len && char_class[(unsigned char)code[cursor]] == CC_DIGIT)
+        cursor++;
+    return cursor;
 }
 
-size_t tokenize_comment(const char *code, size_t cursor) {
-    size_t end = cursor;
-    while (code[end] != 10)
-        end++;
-    return end;
+// First `c` from `cursor`, `len` if there is none. memchr is vectorized.
+size_t scan_char(const char *code, size_t len, size_t cursor, char c) {
+    const char *at = cursor < len ? memchr(code + cursor, c, len - cursor) : NULL;
+    return at != NULL ? (size_t)(at - code) : len;
 }
 
-bool tokenize(char *const code, size_t len, const char *path, Tokens *tokens) {
-
+// Tokens keep spans into `code`, which has to outlive them.
+bool tokenize(const char *code, size_t len, const char *path, Tokens *tokens) {
     size_t cursor = 0;
 
     int col = 1;
     int row = 1;
 
+    // Typical sources have a token every 5-6 bytes, reserving for that skips
+    // most of the regrowth copies on large inputs.
+    if (tokens->cap < (int)(len / 5)) {
+        tokens->cap = len / 5;
+        tokens->data = realloc(tokens->data, tokens->cap * sizeof(Token));
+    }
+
+#define TOKEN(type, n) VEC_ADD(tokens, make_token((type), cursor, (n), LOC(path, col, row), tokens->cnt))
+
     while (cursor < len) {
-        switch (code[cursor]) {
-        case '"': {
-            cursor += 1;
-            size_t end = tokenize_str_literal(code, len, cursor);
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_LIT_STR, cstr_cpy(code + cursor, end - cursor - 1), l, tokens->cnt));
+        unsigned char c = code[cursor];
+        switch (char_class[c]) {
+        case CC_BLANK: {
+            size_t end = scan_blanks(code, len, cursor);
             col += end - cursor;
             cursor = end;
         } break;
-        case '+': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_PLUS, cstr_cpy(code + cursor, 1), l, tokens->cnt));
+        case CC_NEWLINE: {
             cursor++;
-            col++;
-        } break;
-        case '-': {
-            if (code[cursor + 1] == '>') {
-                Loc l = LOC(path, col, row);
-                VEC_ADD(tokens, make_token(TT_POP, cstr_cpy(code + cursor, 2), l, tokens->cnt));
-                cursor += 2;
-                col += 2 - 1;
-            } else {
-                Loc l = LOC(path, col, row);
-                VEC_ADD(tokens, make_token(TT_MINUS, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-                cursor++;
-                col++;
-            }
+            col = 1;
+            row += 1;
         } break;
-        case '*': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_MULT, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
+        case CC_DIGIT: {
+            size_t end = scan_digits(code, len, cursor);
+            TOKEN(TT_LIT_NUMBER, end - cursor);
+            col += end - cursor;
+            cursor = end;
         } break;
-        case '/': {
-            if (code[cursor + 1] == '/') {
-                size_t old = cursor;
-                cursor = tokenize_comment(code, cursor);
-                col += cursor - old;
-            } else {
-                Loc l = LOC(path, col, row);
-                VEC_ADD(tokens, make_token(TT_DIV, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-                cursor++;
-                col++;
-            }
+        case CC_ALPHA: {
+            size_t end = scan_identifier(code, len, cursor);
+            TOKEN(TT_WORD, end - cursor);
+            col += end - cursor;
+            cursor = end;
         } break;
-        case '%': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_MOD, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
+        case CC_QUOTE: {
+            cursor += 1;
+            // Past the closing quote, unclosed strings run to the end.
+            size_t end = scan_char(code, len, cursor, '"') + 1;
+            TOKEN(TT_LIT_STR, end - cursor - 1);
+            col += end - cursor;
+            cursor = end;
         } break;
-        case '<': {
-            if (code[cursor + 1] == '-') {
-                Loc l = LOC(path, col, row);
-                VEC_ADD(tokens, make_token(TT_STASH, cstr_cpy(code + cursor, 2), l, tokens->cnt));
+        case CC_OP: {
+            char next = cursor + 1 < len ? code[cursor + 1] : 0;
+            if (c == '/' && next == '/') {
+                size_t end = scan_char(code, len, cursor, '\n');
+                col += end - cursor;
+                cursor = end;
+            } else if (c == '-' && next == '>') {
+                TOKEN(TT_POP, 2);
+                cursor += 2;
+                col += 2 - 1;
+            } else if (c == '<' && next == '-') {
+                TOKEN(TT_STASH, 2);
                 cursor += 2;
                 col += 2;
             } else {
-                Loc l = LOC(path, col, row);
-                VEC_ADD(tokens, make_token(TT_LT, cstr_cpy(code + cursor, 1), l, tokens->cnt));
+                TOKEN(char_token[c], 1);
                 cursor++;
                 col++;
             }
         } break;
-        case '>': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_GT, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
-        } break;
-        case '=': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_EQ, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
-        } break;
-        case '?': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_DUMP, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
-        } break;
-        case '!': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_BDUMP, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
-        } break;
-        case '.': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_DUP, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
-        } break;
-        case ':': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_2DUP, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
-        } break;
-        case ',': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_DROP, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
-        } break;
-        case ';': {
-            Loc l = LOC(path, col, row);
-            VEC_ADD(tokens, make_token(TT_SWAP, cstr_cpy(code + cursor, 1), l, tokens->cnt));
-            cursor++;
-            col++;
-        } break;
-        case '\t':
-        case ' ': {
-            cursor++;
-            col++;
-        } break;
-        case '\n':
-        case '\r': {
-            cursor++;
-            col = 1;
-            row += 1;
-        } break;
         default: {
-            if (isdigit(code[cursor])) {
-                size_t end = tokenize_number_literal(code, len, cursor);
-                Loc l = LOC(path, col, row);
-                VEC_ADD(tokens, make_token(TT_LIT_NUMBER, cstr_cpy(code + cursor, end - cursor), l, tokens->cnt));
-                col += end - cursor;
-                cursor = end;
-            } else if (isalpha(code[cursor])) {
-                size_t end = tokenize_identifier(code, len, cursor);
-                Loc l = LOC(path, col, row);
-                VEC_ADD(tokens, make_token(TT_WORD, cstr_cpy(code + cursor, end - cursor), l, tokens->cnt));
-                col += end - cursor;
-                cursor = end;
-            } else {
-                printf("Char not handled %c\n", code[cursor]);
-                exit(1);
-            }
+            fprintf(run_out(), "Char not handled %c\n", c);
+            fail(1);
         }
         }
     }
+#undef TOKEN
     return true;
 }
+
+// `main bench-tokenize [mb]`: tokenizes a generated source of roughly `mb`
+// megabytes mixing every token kind and reports the throughput.
+int bench_tokenize(size_t mb) {
+    // A real program, it runs on its own and prints 332833500.
+    const char *snippet = "// sums the squares below a limit\n"
+                          "1000 limit def\n"
+                          "8 cell def\n"
+                          "cell counter mem\n"
+                          "0 loop . limit > do\n"
+                          "    . . * 8 counter deref + counter w64_mem\n"
+                          "    1 <- 1 -> \"iteration done\" , 1 +\n"
+                          "end , 8 counter deref sout 10 putc\n";
+    size_t n = strlen(snippet);
+    size_t len = mb * MB / n * n;
+    char *code = malloc(len + 1);
+    for (size_t i = 0; i < len; i += n)
+        memcpy(code + i, snippet, n);
+    code[len] = 0;
+
+    Tokens tokens = {0};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tokenize(code, len, "bench", &tokens);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("tokenize: %zu bytes, %d tokens in %.3f ms, %.1f MB/s\n", len, tokens.cnt, secs * 1e3,
+           len / secs / MB);
+    VEC_FREE(tokens);
+    free(code);
+    return 0;
+}
 // ;tokenizer
 
 // :parser
@@ -311,9 +433,16 @@ typedef enum {
     OP_SWAP,
     OP_STASH,
     OP_POP,
+    OP_LIBC,
+    // Superinstructions, see select_superinstructions
+    OP_LOAD,       // LIT(size) LIT(addr) deref: op = addr, sub = size
+    OP_STORE,      // LIT(addr) w64_mem: op = addr
+    OP_BINOP_IMM,  // LIT BINOP: op = immediate, sub = BinopType
+    OP_CMP_DO,     // . LIT BINOP do: op = immediate, sub = BinopType, link = do link
+    OP_PUTD_CHAR,  // sout LIT putc: op = char
     OP_COUNT,
 } OpType;
-static_assert(OP_COUNT == 13, "Implement newly added OpType");
+static_assert(OP_COUNT == 19, "Implement newly added OpType");
 
 typedef enum {
     BT_PLUS,
@@ -354,15 +483,27 @@ static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
 typedef struct {
     Loc l;
     OpType t;
+    int sub;
     long op;
     int link;
     int index;
 } Op;
 
+// What the engines execute of an Op. Built once the program is final, at the
+// same index as its Op, which stays around for everything that reports or
+// prints: Loc, token and the compile passes.
+typedef struct {
+    long op;
+    int link;
+    uint16_t t;
+    int16_t sub;
+} Inst;
+static_assert(sizeof(Inst) == 16, "Keep Inst small, it is what the engines stream through");
+
 char *op_to_str(Op op) {
     static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
     static_assert(BT_COUNT == 8, "Implement newly added BinopType");
-    static_assert(OP_COUNT == 13, "Implement newly added OpType");
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
     switch (op.t) {
     case OP_NOP:
         return "OP_NOP";
@@ -446,6 +587,18 @@ char *op_to_str(Op op) {
         return "OP_STASH";
     case OP_POP:
         return "OP_POP";
+    case OP_LIBC:
+        return "OP_LIBC";
+    case OP_LOAD:
+        return "OP_LOAD";
+    case OP_STORE:
+        return "OP_STORE";
+    case OP_BINOP_IMM:
+        return "OP_BINOP_IMM";
+    case OP_CMP_DO:
+        return "OP_CMP_DO";
+    case OP_PUTD_CHAR:
+        return "OP_PUTD_CHAR";
     default:
         return "Unknown type";
     }
@@ -455,43 +608,490 @@ char *op_to_str(Op op) {
 List(Program, Op);
 List(UStrList, size_t);
 
-#define MAX_MEMORY 64 * KB
-#define MAX_DEFINED 1000
+#define MAX_MEMORY (16 * MB)
+#define MAX_HEAP (1024 * MB)
+
+// Bytes reserved for `mem` and string literals, `--heap`.
+size_t heap_size = MAX_MEMORY;
+
 typedef struct {
     Program prog;
 
-    UStrList definedTable;
-    int definedData[MAX_DEFINED];
 
-    int constData[MAX_DEFINED];
-    char mem[MAX_MEMORY];
+    char *mem; // heap_size bytes, see heap_map
     size_t mem_ptr;
+
+    Inst *code; // prog without the debug info, see build_code
 } VM;
 
+// Reserves the heap without committing it, pages are only backed once a
+// program touches them.
+char *heap_map(void) {
+    char *mem = mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        fprintf(run_out(), "E: Can't reserve a heap of %zu bytes.\n", heap_size);
+        fail(1);
+    }
+    track_map(mem, heap_size);
+    return mem;
+}
+
+// Bytes of vm.mem a copy of the program has to start with, `mem` buffers are
+// zero until the program writes them.
+size_t mem_init_len(VM *vm) {
+    size_t n = vm->mem_ptr;
+    while (n > 0 && vm->mem[n - 1] == 0)
+        n--;
+    return n;
+}
+
 typedef struct {
     int index;
     long val;
     OpType type;
     size_t lit_ptr;
     int link;
+    int sym;
+    bool addr; // val is an offset into vm.mem, moved when merged elsewhere
 } DefineData;
 List(Defines, DefineData);
 
+// :symbols
+// Interned names. Every distinct word gets a dense id the first time it is
+// seen, lookups hash the name once and only compare strings on collisions.
+List(IntList, int);
+List(ByteList, char);
+
+typedef struct {
+    UStrList names; // id -> canonical reference in the run's StrArena
+    int *slots;     // id + 1, 0 marks an empty slot
+    int cap;
+} Symbols;
+
+void symbols_grow(Symbols *syms, const StrArena *strs) {
+    free(syms->slots);
+    syms->cap = syms->cap == 0 ? 64 : syms->cap * 2;
+    syms->slots = calloc(syms->cap, sizeof(int));
+    FOR_LIST(syms->names) {
+        size_t ref = VEC_GET(syms->names, i);
+        size_t slot = hash_bytes(CSTR(strs, ref), str_len(strs, ref)) & (syms->cap - 1);
+        while (syms->slots[slot] != 0)
+            slot = (slot + 1) & (syms->cap - 1);
+        syms->slots[slot] = i + 1;
+    }
+}
+
+// Returns the id of `name`, or -1 with `slot` set to where it belongs.
+int symbols_find(Symbols *syms, const StrArena *strs, const char *name, size_t len, size_t *slot) {
+    if ((syms->names.cnt + 1) * 2 > syms->cap)
+        symbols_grow(syms, strs);
+
+    *slot = hash_bytes(name, len) & (syms->cap - 1);
+    while (syms->slots[*slot] != 0) {
+        int id = syms->slots[*slot] - 1;
+        size_t ref = VEC_GET(syms->names, id);
+        if (str_len(strs, ref) == len && memcmp(CSTR(strs, ref), name, len) == 0)
+            return id;
+        *slot = (*slot + 1) & (syms->cap - 1);
+    }
+    return -1;
+}
+
+int symbols_add(Symbols *syms, size_t ref, size_t slot) {
+    int id = syms->names.cnt;
+    VEC_ADD(&syms->names, ref);
+    syms->slots[slot] = id + 1;
+    return id;
+}
+
+int intern(Symbols *syms, StrArena *strs, const char *name, size_t len) {
+    size_t slot;
+    int id = symbols_find(syms, strs, name, len, &slot);
+    return id != -1 ? id : symbols_add(syms, str_push(strs, name, len), slot);
+}
+
+void free_symbols(Symbols *syms) {
+    VEC_FREE(syms->names);
+    free(syms->slots);
+}
+// ;symbols
+
+typedef struct {
+    char *path;
+    char *real; // canonical path, identifies the file across includes
+    uint64_t hash;
+    long size;
+    long mtime; // nanoseconds, a file rewritten within the same second still differs
+} Dep;
+List(Deps, Dep);
+
+typedef enum {
+    ENGINE_AUTO = 0,
+    ENGINE_SWITCH,
+    ENGINE_THREADED,
+    ENGINE_JIT,
+    ENGINE_TOS,
+    ENGINE_COUNT,
+} Engine;
+
+const char *engine_names[ENGINE_COUNT] = {
+    [ENGINE_AUTO] = "auto",
+    [ENGINE_SWITCH] = "switch",
+    [ENGINE_THREADED] = "threaded",
+    [ENGINE_JIT] = "jit",
+    [ENGINE_TOS] = "tos",
+};
+
+typedef struct {
+    Engine engine;
+    bool no_opt;
+    bool stats;
+    bool seq_profile; // count superinstruction candidates instead of fusing them
+    bool time; // print the wall time of every phase
+    bool stats_json; // the --stats report as JSON
+    const char *profile; // --profile, the prefix of the files it writes
+} Options;
+
+typedef enum {
+    PH_FOLD = 0,
+    PH_DUP_DROP,
+    PH_LIT_DROP,
+    PH_SWAP_SWAP,
+    PH_STASH_POP,
+    PH_COUNT,
+} PeepholeType;
+
+typedef enum {
+    SI_LOAD = 0,
+    SI_STORE,
+    SI_BINOP_IMM,
+    SI_CMP_DO,
+    SI_PUTD_CHAR,
+    SI_COUNT,
+} SuperInstrType;
+
+typedef enum {
+    PHASE_TOKENIZE = 0,
+    PHASE_PARSE,
+    PHASE_INCLUDE,
+    PHASE_DEFINE,
+    PHASE_LINK,
+    PHASE_VERIFY,
+    PHASE_OPTIMIZE,
+    PHASE_RUN,
+    PHASE_COUNT,
+} Phase;
+
+static const char *phase_names[PHASE_COUNT] = {"tokenize", "parse", "include", "define", "link", "verify", "optimize", "run"};
+
+typedef struct {
+    double phase_ms[PHASE_COUNT]; // wall time, see lap
+    long tokens;
+    long parsed_ops; // before includes are merged and the optimizer ran
+    long peephole[PH_COUNT]; // ops removed by each pattern
+    long superinstr[SI_COUNT]; // ops removed by fusing each sequence
+    long jit_size; // bytes of machine code, with --jit
+    long jit_fallbacks; // ops without a template, run through jit_step
+    long alloc_count; // `malloc` calls
+    long alloc_live; // bytes held by live blocks
+    long alloc_peak;
+    Engine engine; // the one selected, --stats counts on the switch loop
+} Stats;
+
+// :alloc
+// Allocator behind the `malloc` and `free` words, owned by the ProgramRun.
+// Requests up to 2^(ALLOC_MIN_SHIFT + ALLOC_CLASSES - 1) bytes are rounded up
+// to a power of two size class and bump allocated from ALLOC_CHUNK sized
+// chunks, freed blocks go on the free list of their class. Bigger ones are
+// malloc'd on their own. `arena_reset` frees everything at once.
+// Every block is preceded by its class, or ALLOC_LARGE.
+#define ALLOC_MIN_SHIFT 4
+#define ALLOC_CLASSES 9
+#define ALLOC_CHUNK (64 * KB)
+#define ALLOC_LARGE -1L
+#define ALLOC_HEADER 16 // keeps blocks 16 byte aligned
+
+typedef struct AllocChunk {
+    struct AllocChunk *next;
+    size_t used;
+    char _Alignas(16) data[];
+} AllocChunk;
+
+typedef struct AllocLarge {
+    struct AllocLarge *prev, *next;
+    size_t size;
+    long cls; // always ALLOC_LARGE, right before the block
+} AllocLarge;
+
+typedef struct {
+    AllocChunk *chunks; // the one bumped from first
+    AllocLarge *large;
+    void *free[ALLOC_CLASSES]; // the next block is stored in the block
+} Allocator;
+// ;alloc
+
+// Basic blocks of the linked program, see build_cfg.
+typedef struct {
+    int start; // ops [start, end), only the last one can branch
+    int end;
+    IntList succ; // block indices
+    IntList pred;
+} Block;
+List(Blocks, Block);
+
+typedef struct {
+    Blocks blocks;
+    int *block_of;   // op -> its block
+    bool *is_target; // ops some `link` jumps to, one past the end included
+} Cfg;
+
+typedef struct SeqProfile SeqProfile;
+typedef struct DispatchCounts DispatchCounts;
+typedef struct Profile Profile;
+
+// The modules being compiled that led to a file, see load_module.
+typedef struct IncludeChain {
+    const char *real;
+    const struct IncludeChain *parent;
+} IncludeChain;
+
 typedef struct {
     VM vm;
     Tokens tokens;
     char *code;
     Defines defines;
+    Deps deps;
+    Options opts;
+    bool verified; // stack effects proven in bounds, see verify_stack
+    Cfg cfg;       // rebuilt whenever the ops change
+    Stats stats;
+    SeqProfile *seq; // only with --seq-profile
+    DispatchCounts *counts; // only with --stats
+    Profile *profile; // only with --profile
+    StrArena strs;
+    Symbols syms;
+    IntList sym_defines; // sym -> first define of that name, -1 if none
+    Allocator alloc;
+    const IncludeChain *chain; // NULL for the program itself
+    FILE *out;                 // where the program prints, run_out() when compiled
 } ProgramRun;
 
-size_t push_str_to_mem(VM *vm, size_t temp_ptr) {
-    size_t len = strlen(CSTR(temp_ptr));
-    memcpy(vm->mem + vm->mem_ptr, CSTR(temp_ptr), len);
+// Copies `len` bytes plus a NUL terminator into vm memory, -1 when it is full.
+long push_str_to_mem(VM *vm, const char *src, size_t len) {
+    if (vm->mem_ptr + len + 1 > heap_size)
+        return -1;
+    memcpy(vm->mem + vm->mem_ptr, src, len);
+    vm->mem[vm->mem_ptr + len] = 0;
     size_t at = vm->mem_ptr;
     vm->mem_ptr += len + 1;
     return at;
 }
 
+// :alloc
+int alloc_class(size_t size) {
+    int cls = 0;
+    while (((size_t)1 << (cls + ALLOC_MIN_SHIFT)) < size)
+        cls++;
+    return cls;
+}
+
+void alloc_account(ProgramRun *prog, long bytes) {
+    prog->stats.alloc_live += bytes;
+    if (prog->stats.alloc_live > prog->stats.alloc_peak)
+        prog->stats.alloc_peak = prog->stats.alloc_live;
+}
+
+void *vm_malloc(ProgramRun *prog, long size) {
+    Allocator *a = &prog->alloc;
+    if (size < 0)
+        return NULL;
+    prog->stats.alloc_count++;
+
+    int cls = alloc_class(size);
+    if (cls >= ALLOC_CLASSES) {
+        AllocLarge *l = malloc(sizeof(AllocLarge) + size);
+        if (l == NULL)
+            return NULL;
+        *l = (AllocLarge){NULL, a->large, size, ALLOC_LARGE};
+        if (a->large != NULL)
+            a->large->prev = l;
+        a->large = l;
+        alloc_account(prog, size);
+        return l + 1;
+    }
+
+    size_t bytes = (size_t)1 << (cls + ALLOC_MIN_SHIFT);
+    if (a->free[cls] != NULL) {
+        void *block = a->free[cls];
+        a->free[cls] = *(void **)block;
+        alloc_account(prog, bytes);
+        return block;
+    }
+    AllocChunk *c = a->chunks;
+    if (c == NULL || c->used + ALLOC_HEADER + bytes > ALLOC_CHUNK) {
+        c = malloc(sizeof(AllocChunk) + ALLOC_CHUNK);
+        if (c == NULL)
+            return NULL;
+        *c = (AllocChunk){a->chunks, 0};
+        a->chunks = c;
+    }
+    char *block = c->data + c->used + ALLOC_HEADER;
+    c->used += ALLOC_HEADER + bytes;
+    ((long *)block)[-1] = cls;
+    alloc_account(prog, bytes);
+    return block;
+}
+
+void vm_free(ProgramRun *prog, void *block) {
+    Allocator *a = &prog->alloc;
+    if (block == NULL)
+        return;
+    long cls = ((long *)block)[-1];
+    if (cls == ALLOC_LARGE) {
+        AllocLarge *l = (AllocLarge *)block - 1;
+        if (l->prev != NULL)
+            l->prev->next = l->next;
+        else
+            a->large = l->next;
+        if (l->next != NULL)
+            l->next->prev = l->prev;
+        prog->stats.alloc_live -= l->size;
+        free(l);
+        return;
+    }
+    prog->stats.alloc_live -= (long)1 << (cls + ALLOC_MIN_SHIFT);
+    *(void **)block = a->free[cls];
+    a->free[cls] = block;
+}
+
+// Frees every block. One chunk is kept to bump from again.
+void vm_arena_reset(ProgramRun *prog) {
+    Allocator *a = &prog->alloc;
+    while (a->large != NULL) {
+        AllocLarge *next = a->large->next;
+        free(a->large);
+        a->large = next;
+    }
+    if (a->chunks != NULL) {
+        AllocChunk *c = a->chunks->next;
+        while (c != NULL) {
+            AllocChunk *next = c->next;
+            free(c);
+            c = next;
+        }
+        a->chunks->next = NULL;
+        a->chunks->used = 0;
+    }
+    memset(a->free, 0, sizeof(a->free));
+    prog->stats.alloc_live = 0;
+}
+
+void free_allocator(ProgramRun *prog) {
+    vm_arena_reset(prog);
+    free(prog->alloc.chunks);
+    prog->alloc.chunks = NULL;
+}
+// ;alloc
+
+// :libc
+// Foreign functions reachable from concat. Each one is resolved to its index
+// in `libc_funcs` while parsing, so calling it never compares names.
+// Arguments are popped into `args` in order, `args[0]` being the top of the stack.
+#define LIBC_MAX_ARITY 6
+
+typedef struct {
+    const char *name;
+    int arity;
+    bool returns;
+    bool noreturn; // control never comes back, e.g. exit
+    long (*call)(ProgramRun *prog, long *args);
+    const char *c_call; // the same call for emit-c, `aN` being args[N]
+} LibcFunc;
+
+long libc_open(ProgramRun *prog, long *args) {
+    return open(prog->vm.mem + args[0], args[1]);
+}
+
+long libc_close(ProgramRun *prog, long *args) {
+    _ prog;
+    return close(args[0]);
+}
+
+long libc_lseek(ProgramRun *prog, long *args) {
+    _ prog;
+    return lseek(args[0], args[1], args[2]);
+}
+
+long libc_malloc(ProgramRun *prog, long *args) {
+    return (long)vm_malloc(prog, (int)args[0]);
+}
+
+long libc_free(ProgramRun *prog, long *args) {
+    vm_free(prog, (void *)args[0]);
+    return 0;
+}
+
+long libc_arena_reset(ProgramRun *prog, long *args) {
+    _ args;
+    vm_arena_reset(prog);
+    return 0;
+}
+
+long libc_read(ProgramRun *prog, long *args) {
+    _ prog;
+    return read(args[0], (void *)args[1], args[2]);
+}
+
+long libc_write(ProgramRun *prog, long *args) {
+    _ prog;
+    return write(args[0], (void *)args[1], args[2]);
+}
+
+long libc_pread(ProgramRun *prog, long *args) {
+    _ prog;
+    return pread(args[0], (void *)args[1], args[2], args[3]);
+}
+
+long libc_pwrite(ProgramRun *prog, long *args) {
+    _ prog;
+    return pwrite(args[0], (void *)args[1], args[2], args[3]);
+}
+
+long libc_mmap(ProgramRun *prog, long *args) {
+    _ prog;
+    return (long)mmap((void *)args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+long libc_munmap(ProgramRun *prog, long *args) {
+    _ prog;
+    return munmap((void *)args[0], args[1]);
+}
+
+long libc_exit(ProgramRun *prog, long *args) {
+    _ prog;
+    fail(args[0]);
+}
+
+// Append only, precompiled images store indices into this table.
+LibcFunc libc_funcs[] = {
+    {"open", 2, true, false, libc_open, "open(mem + a0, a1)"},                         // mode path -> fd
+    {"close", 1, false, false, libc_close, "close(a0)"},                               // fd ->
+    {"lseek", 3, true, false, libc_lseek, "lseek(a0, a1, a2)"},                        // whence off fd -> off
+    {"malloc", 1, true, false, libc_malloc, "(long)malloc((int)a0)"},                  // size -> ptr
+    {"free", 1, false, false, libc_free, "free((void *)a0)"},                          // ptr ->
+    {"read", 3, false, false, libc_read, "read(a0, (void *)a1, a2)"},                  // size ptr fd ->
+    {"exit", 1, false, true, libc_exit, "exit(a0)"},                                   // code ->
+    {"write", 3, true, false, libc_write, "write(a0, (void *)a1, a2)"},                // size ptr fd -> n
+    {"pread", 4, true, false, libc_pread, "pread(a0, (void *)a1, a2, a3)"},            // off size ptr fd -> n
+    {"pwrite", 4, true, false, libc_pwrite, "pwrite(a0, (void *)a1, a2, a3)"},         // off size ptr fd -> n
+    {"mmap", 6, true, false, libc_mmap, "(long)mmap((void *)a0, a1, a2, a3, a4, a5)"}, // off fd flags prot len addr -> ptr
+    {"munmap", 2, false, false, libc_munmap, "munmap((void *)a0, a1)"},                // len ptr ->
+    {"arena_reset", 0, false, false, libc_arena_reset, "(void)0"},                     // ->
+};
+#define LIBC_COUNT (int)(sizeof(libc_funcs) / sizeof(libc_funcs[0]))
+
+// ;libc
+
 Op parse_binop(Token t) {
     static_assert(BT_COUNT == 8, "Implement newly added BinopType");
     switch (t.t) {
@@ -512,67 +1112,58 @@ Op parse_binop(Token t) {
     case TT_EQ:
         return (Op){.l = t.l, .t = OP_BINOP, .op = BT_EQ, .link = 0};
     default:
-        return (Op){t.l, OP_NOP, 0, 0, t.index};
+        return (Op){t.l, OP_NOP, 0, 0, 0, t.index};
     }
-    return (Op){t.l, OP_NOP, 0, 0, t.index};
+    return (Op){t.l, OP_NOP, 0, 0, 0, t.index};
 }
 
 #define VEC_LEN(vec) (vec).cnt
 
-int find_defined(ProgramRun program, Op o) {
-    size_t to_check = VEC_GET(program.tokens, o.index).lit_ptr;
-    for (int i = 0; i < VEC_LEN(program.vm.definedTable); i++) {
-        size_t it = VEC_GET(program.vm.definedTable, i);
-        // printf("> %s == %s\n", CSTR(to_check), CSTR(it));
-        if (str_eq(to_check, CSTR(it))) {
-            return i;
-        }
-    }
-    return -1;
+typedef struct {
+    const char *name;
+    IntrinsicType type;
+} Keyword;
+
+Keyword keywords[] = {
+    {"sout", W_PUTD},
+    {"loop", W_LOOP},
+    {"endif", W_ENDIF},
+    {"do", W_DO},
+    {"putc", W_PUTC},
+    {"println", W_PRINTLN},
+    {"print", W_PRINT},
+    {"if", W_IF},
+    {"else", W_ELSE},
+    {"end", W_END},
+    {"mem", W_MEM},
+    {"w_mem", W_W_MEM},
+    {"w64_mem", W_W_MEM64},
+    {"deref", W_DEREF},
+    {"as_str", W_AS_STR},
+    {"def", W_DEF},
+    {"include", W_INCLUDE},
+};
+#define KEYWORD_COUNT (int)(sizeof(keywords) / sizeof(keywords[0]))
+static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
+
+// Keywords and libc words are interned first so their ids double as an
+// index into `keywords` and `libc_funcs`.
+void init_symbols(ProgramRun *prog) {
+    for (int i = 0; i < KEYWORD_COUNT; i++)
+        intern(&prog->syms, &prog->strs, keywords[i].name, strlen(keywords[i].name));
+    for (int i = 0; i < LIBC_COUNT; i++)
+        intern(&prog->syms, &prog->strs, libc_funcs[i].name, strlen(libc_funcs[i].name));
 }
 
-Op parse_identifier(Token t, ProgramRun *program) {
-    Op o = (Op){.l = t.l, .t = OP_INTRINSIC, .op = W_DEFINED, .link = 0, .index = t.index};
+Op parse_identifier(Token *t, ProgramRun *program) {
+    Op o = (Op){.l = t->l, .t = OP_INTRINSIC, .op = W_DEFINED, .link = 0, .index = t->index};
 
-    static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
-    if (str_eq(t.lit_ptr, "sout")) {
-        o.op = W_PUTD;
-    } else if (str_eq(t.lit_ptr, "loop")) {
-        o.op = W_LOOP;
-    } else if (str_eq(t.lit_ptr, "endif")) {
-        o.op = W_ENDIF;
-    } else if (str_eq(t.lit_ptr, "do")) {
-        o.op = W_DO;
-    } else if (str_eq(t.lit_ptr, "putc")) {
-        o.op = W_PUTC;
-    } else if (str_eq(t.lit_ptr, "println")) {
-        o.op = W_PRINTLN;
-    } else if (str_eq(t.lit_ptr, "print")) {
-        o.op = W_PRINT;
-    } else if (str_eq(t.lit_ptr, "if")) {
-        o.op = W_IF;
-    } else if (str_eq(t.lit_ptr, "else")) {
-        o.op = W_ELSE;
-    } else if (str_eq(t.lit_ptr, "end")) {
-        o.op = W_END;
-    } else if (str_eq(t.lit_ptr, "mem")) {
-        o.op = W_MEM;
-    } else if (str_eq(t.lit_ptr, "w_mem")) {
-        o.op = W_W_MEM;
-    } else if (str_eq(t.lit_ptr, "w64_mem")) {
-        o.op = W_W_MEM64;
-    } else if (str_eq(t.lit_ptr, "deref")) {
-        o.op = W_DEREF;
-    } else if (str_eq(t.lit_ptr, "as_str")) {
-        o.op = W_AS_STR;
-    } else if (str_eq(t.lit_ptr, "def")) {
-        o.op = W_DEF;
-    } else if (str_eq(t.lit_ptr, "include")) {
-        o.op = W_INCLUDE;
-    } else {
-        if (find_defined(*program, o) == -1) {
-            VEC_ADD(&program->vm.definedTable, t.lit_ptr);
-        }
+    t->sym = intern(&program->syms, &program->strs, program->code + t->off, t->len);
+    if (t->sym < KEYWORD_COUNT) {
+        o.op = keywords[t->sym].type;
+    } else if (t->sym < KEYWORD_COUNT + LIBC_COUNT) {
+        o.t = OP_LIBC;
+        o.op = t->sym - KEYWORD_COUNT;
     }
 
     return o;
@@ -596,15 +1187,21 @@ bool parse(ProgramRun *prog) {
             VEC_ADD(&vm->prog, parse_binop(t));
         } break;
         case TT_LIT_NUMBER: {
-            Op o = (Op){.l = t.l, .t = OP_LIT_NUMBER, .op = atoi(CSTR(t.lit_ptr)), .link = 0};
+            Op o = (Op){.l = t.l, .t = OP_LIT_NUMBER, .op = atoi(prog->code + t.off), .link = 0};
             VEC_ADD(&vm->prog, o);
         } break;
         case TT_LIT_STR: {
-            Op o = (Op){.l = t.l, .t = OP_LIT_STR, .op = push_str_to_mem(vm, t.lit_ptr), .link = 0};
+            Op o = (Op){.l = t.l, .t = OP_LIT_STR, .op = push_str_to_mem(vm, prog->code + t.off, t.len), .link = 0};
+            if (o.op == -1) {
+                fprintf(run_out(), "E: ");
+                printloc(t.l);
+                fprintf(run_out(), " Out of memory for string literal, the limit is %zu bytes.\n", heap_size);
+                fail(1);
+            }
             VEC_ADD(&vm->prog, o);
         } break;
         case TT_WORD: {
-            VEC_ADD(&vm->prog, parse_identifier(t, prog));
+            VEC_ADD(&vm->prog, parse_identifier(&VEC_GET(prog->tokens, i), prog));
         } break;
         case TT_DUMP: {
             Op o = (Op){.l = t.l, .t = OP_DUMP, .op = 0, .link = 0};
@@ -651,8 +1248,8 @@ bool parse(ProgramRun *prog) {
     VEC_ADD(&vm->prog, o);
 
 #ifdef DEBUG
-    for (int i = 0; i < vm->definedTable.cnt; i++) {
-        printf("[%d] %s\n", i, CSTR(vm->definedTable.data[i]));
+    for (int i = 0; i < prog->syms.names.cnt; i++) {
+        printf("[%d] %s\n", i, CSTR(&prog->strs, prog->syms.names.data[i]));
     }
 #endif
 
@@ -665,7 +1262,8 @@ bool is_intrinsic(Op o, IntrinsicType t) {
     return o.t == OP_INTRINSIC && (IntrinsicType)o.op == t;
 }
 
-#define TOKEN_LIT(prog, index) CSTR(VEC_GET((prog).tokens, (index)).lit_ptr)
+// Name of a word token, once parse interned it.
+#define TOKEN_LIT(prog, index) CSTR(&(prog).strs, VEC_GET((prog).syms.names, VEC_GET((prog).tokens, (index)).sym))
 
 void print_operations(ProgramRun prog) {
     for (int i = 0; i < VEC_LEN(prog.vm.prog); i++) {
@@ -676,72 +1274,63 @@ void print_operations(ProgramRun prog) {
         printf("    > loc: ");
         printloc(it.l);
         printf("\n");
-        printf("    > repr: %s\n", TOKEN_LIT(prog, it.index));
+        Token t = VEC_GET(prog.tokens, it.index);
+        printf("    > repr: %.*s\n", (int)t.len, prog.code + t.off);
     }
 }
 
-#define FOR_LIST(list) for (int i = 0; i < (list).cnt; i++)
-
-bool is_libc_word(ProgramRun prog, Op o) {
-    return is_intrinsic(o, W_DEFINED) && (str_eq(VEC_GET(prog.tokens, o.index).lit_ptr, "open") || str_eq(VEC_GET(prog.tokens, o.index).lit_ptr, "close") || str_eq(VEC_GET(prog.tokens, o.index).lit_ptr, "malloc") || str_eq(VEC_GET(prog.tokens, o.index).lit_ptr, "free") || str_eq(VEC_GET(prog.tokens, o.index).lit_ptr, "read") || str_eq(VEC_GET(prog.tokens, o.index).lit_ptr, "exit") || str_eq(VEC_GET(prog.tokens, o.index).lit_ptr, "lseek"));
-}
 
-int find_previous_defined(Defines defines, size_t lit_ptr) {
-    FOR_LIST(defines) {
-        DefineData data = VEC_GET(defines, i);
-        if (str_eq(data.lit_ptr, CSTR(lit_ptr))) {
-            return i;
-        }
-    }
-    return -1;
+int find_previous_defined(ProgramRun *prog, int sym) {
+    if (sym < 0 || sym >= prog->sym_defines.cnt)
+        return -1;
+    return VEC_GET(prog->sym_defines, sym);
 }
 
-void delete_op(Program *prog, int index) {
-    assert((index >= 0 && index < prog->cnt) && "Invalid index");
-    int amount = (prog->cnt - index - 1) * sizeof(Op);
-    void *dest = prog->data + index;    // data[index]
-    void *src = prog->data + index + 1; // data[index++]
-    memmove(dest, src, amount);
-    prog->cnt--;
+void add_define(ProgramRun *prog, DefineData data) {
+    while (prog->sym_defines.cnt <= data.sym)
+        VEC_ADD(&prog->sym_defines, -1);
+    if (VEC_GET(prog->sym_defines, data.sym) == -1)
+        VEC_GET(prog->sym_defines, data.sym) = prog->defines.cnt;
+    VEC_ADD(&prog->defines, data);
 }
 
-ProgramRun run_program(const char *);
-void clean_program_run(ProgramRun *);
+#define TOKEN_SYM(prog, index) VEC_GET((prog).tokens, (index)).sym
 
-void process_include(ProgramRun *current) {
+bool has_link(Op o);
 
-    int ip = 0;
-    while (VEC_GET(current->vm.prog, ip).t != OP_NOP) {
-        Op it = VEC_GET(current->vm.prog, ip);
-        if (is_intrinsic(it, W_INCLUDE)) {
-            Op name = VEC_GET(current->vm.prog, ip - 1);
-            const char *path = CSTR(name.op);
-            ProgramRun run = run_program(path);
-            for (int i = 0; i < VEC_LEN(run.defines); i++) {
-                VEC_ADD(&current->defines, VEC_GET(run.defines, i));
-            }
-            clean_program_run(&run);
-        }
-        ip += 1;
+// Rebuilds the program after ops were dropped or replaced. `remap` maps every
+// old index, plus one past the end, to the index of the op now standing there.
+void relink(Program *p, int *remap) {
+    FOR_LIST(*p) {
+        Op *o = &VEC_GET(*p, i);
+        if (has_link(*o))
+            o->link = remap[o->link];
     }
+}
 
-    for (int i = current->vm.prog.cnt - 1; i > 0; i--) {
-        Op it = VEC_GET(current->vm.prog, i);
-        if (is_intrinsic(it, W_INCLUDE)) {
-            delete_op(&current->vm.prog, i);
-            delete_op(&current->vm.prog, i - 1);
-        }
+// Drops every op marked in `dead` in a single pass, the rest keep their order.
+void compact_program(Program *p, const bool *dead) {
+    int *remap = malloc(sizeof(int) * (p->cnt + 1));
+    int n = 0;
+    FOR_LIST(*p) {
+        remap[i] = n;
+        if (!dead[i])
+            VEC_GET(*p, n++) = VEC_GET(*p, i);
     }
-
-    ip = 0;
+    remap[p->cnt] = n;
+    p->cnt = n;
+    relink(p, remap);
+    free(remap);
 }
 
+void process_include(ProgramRun *);
+
 bool replace_defined(ProgramRun *prog) {
     int ip = 0;
 
     while (VEC_GET(prog->vm.prog, ip).t != OP_NOP) {
         Op *it = &VEC_GET(prog->vm.prog, ip);
-        if (it->t == OP_NOP || is_libc_word(*prog, *it))
+        if (it->t == OP_NOP)
             break;
         Op next = VEC_GET(prog->vm.prog, ip + 1);
 
@@ -751,7 +1340,7 @@ bool replace_defined(ProgramRun *prog) {
             Op name = VEC_GET(prog->vm.prog, ip - 1);
 
             if (is_intrinsic(val, W_DEFINED)) {
-                int idx = find_previous_defined(prog->defines, VEC_GET(prog->tokens, val.index).lit_ptr);
+                int idx = find_previous_defined(prog, TOKEN_SYM(*prog, val.index));
                 assert(idx >= 0 && "Something went to wrong");
                 val.link = idx;
             }
@@ -760,16 +1349,20 @@ bool replace_defined(ProgramRun *prog) {
                 prog->defines.cnt,
                 val.op,
                 val.t,
-                VEC_GET(prog->tokens, name.index).lit_ptr,
+                VEC_GET(prog->syms.names, TOKEN_SYM(*prog, name.index)),
                 val.link,
+                TOKEN_SYM(*prog, name.index),
+                val.t == OP_LIT_STR,
             };
-            VEC_ADD(&prog->defines, data);
+            add_define(prog, data);
         } else if (is_intrinsic(*it, W_MEM)) {
             Op val = VEC_GET(prog->vm.prog, ip - 2);
             Op *name = &VEC_GET(prog->vm.prog, ip - 1);
 
-            if (is_intrinsic(val, W_DEFINED)) {
-                int idx = find_previous_defined(prog->defines, VEC_GET(prog->tokens, val.index).lit_ptr);
+            // Only a defined size reserves memory, a literal one is the value.
+            bool reserved = is_intrinsic(val, W_DEFINED);
+            if (reserved) {
+                int idx = find_previous_defined(prog, TOKEN_SYM(*prog, val.index));
                 if (idx == -1) {
                     assert(false);
                 }
@@ -778,6 +1371,12 @@ bool replace_defined(ProgramRun *prog) {
                     data = VEC_GET(prog->defines, data.link);
                 }
 
+                if (prog->vm.mem_ptr + data.val > heap_size) {
+                    fprintf(run_out(), "E: ");
+                    printloc(val.l);
+                    fprintf(run_out(), " Out of memory for %ld bytes of `mem`, the limit is %zu bytes.\n", data.val, heap_size);
+                    fail(1);
+                }
                 val.op = prog->vm.mem_ptr;
                 prog->vm.mem_ptr += data.val;
                 val.t = data.type;
@@ -788,15 +1387,17 @@ bool replace_defined(ProgramRun *prog) {
                 prog->defines.cnt,
                 val.op,
                 val.t,
-                VEC_GET(prog->tokens, name->index).lit_ptr,
+                VEC_GET(prog->syms.names, TOKEN_SYM(*prog, name->index)),
                 val.link,
+                TOKEN_SYM(*prog, name->index),
+                reserved,
             };
-            VEC_ADD(&prog->defines, data);
+            add_define(prog, data);
         } else if (is_intrinsic(*it, W_DEFINED) && (!is_intrinsic(next, W_DEF) && !is_intrinsic(next, W_MEM))) {
             // If is defined or and not pre def or mem, find repr in defines and link
-            int idx = find_previous_defined(prog->defines, VEC_GET(prog->tokens, it->index).lit_ptr);
+            int idx = find_previous_defined(prog, TOKEN_SYM(*prog, it->index));
             if (idx < 0) {
-                printf("Error: Word not defined %s\n", TOKEN_LIT(*prog, it->index));
+                fprintf(run_out(), "Error: Word not defined %s\n", TOKEN_LIT(*prog, it->index));
                 return false;
             }
             it->link = idx;
@@ -806,22 +1407,22 @@ bool replace_defined(ProgramRun *prog) {
 
     // Remove constant definitions and memory definitions
     // value name 'def' | value name 'mem'
-    for (int i = prog->vm.prog.cnt - 1; i > 0; i--) {
+    bool *dead = calloc(prog->vm.prog.cnt, sizeof(bool));
+    for (int i = 2; i < prog->vm.prog.cnt; i++) {
         Op it = VEC_GET(prog->vm.prog, i);
-        if (is_intrinsic(it, W_DEF) || is_intrinsic(it, W_MEM)) {
-            delete_op(&prog->vm.prog, i);
-            delete_op(&prog->vm.prog, i - 1);
-            delete_op(&prog->vm.prog, i - 2);
-        }
+        if (is_intrinsic(it, W_DEF) || is_intrinsic(it, W_MEM))
+            dead[i] = dead[i - 1] = dead[i - 2] = true;
     }
+    compact_program(&prog->vm.prog, dead);
+    free(dead);
 
     ip = 0;
     while (VEC_GET(prog->vm.prog, ip).t != OP_NOP) {
         Op *it = &VEC_GET(prog->vm.prog, ip);
         if (it->t == OP_NOP)
             break;
-        if (is_intrinsic(*it, W_DEFINED) && !is_libc_word(*prog, *it)) {
-            int idx = find_previous_defined(prog->defines, VEC_GET(prog->tokens, it->index).lit_ptr);
+        if (is_intrinsic(*it, W_DEFINED)) {
+            int idx = find_previous_defined(prog, TOKEN_SYM(*prog, it->index));
             DefineData data = VEC_GET(prog->defines, idx);
             if (data.type == OP_INTRINSIC && data.val == W_DEFINED) {
                 it->op = prog->defines.data[data.link].val;
@@ -838,7 +1439,7 @@ bool replace_defined(ProgramRun *prog) {
     printf("=> Collected defines:\n");
     FOR_LIST(prog->defines) {
         DefineData data = VEC_GET(prog->defines, i);
-        printf("    > [%d] %ld %s %s\n", i, data.val, op_to_str((Op){.t = data.type}), CSTR(data.lit_ptr));
+        printf("    > [%d] %ld %s %s\n", i, data.val, op_to_str((Op){.t = data.type}), CSTR(&prog->strs, data.lit_ptr));
     }
 #endif
 
@@ -848,116 +1449,212 @@ bool replace_defined(ProgramRun *prog) {
 // ;defined
 
 #define MAX_STACK 100
+#define MAX_STACK_SIZE (1 << 24)
+
+// Slots in the data and back stack, `--stack-size` and `--backstack-size`.
+// The last slot is never usable, pushing into it is the overflow.
+int stack_size = MAX_STACK;
+int backstack_size = MAX_STACK;
+
+// `!` prints as many back stack slots as the data stack holds, so the back
+// stack is never allocated smaller than that.
+int backstack_slots(void) {
+    return backstack_size > stack_size ? backstack_size : stack_size;
+}
 
 typedef enum {
     ERR_OVERFLOW,
+    ERR_BACK_OVERFLOW,
     ERR_UNDERFLOW,
     ERR_UNCLOSED_LOOP,
     ERR_UNCLOSED_IF,
     ERR_NO_DO,
+    ERR_OUT_OF_MEMORY,
 } ErrorType;
 
-void error(ErrorType type, Op op, const char *msg, ...) {
-    va_list list;
-    va_start(list, msg);
-
-    printf("E: ");
-    printloc(op.l);
-    printf(" ");
+// Everything error() prints before the message, the gen backend bakes it
+// into its error stubs.
+int error_prefix(char *buf, size_t cap, ErrorType type, Op op) {
+    int n = snprintf(buf, cap, "E: %s:%d:%d: ", op.l.path, op.l.row, op.l.col);
+    if (n < 0 || (size_t)n >= cap)
+        return n;
 
     switch (type) {
     case ERR_OVERFLOW:
-        printf("Stack overflow! Reach limit of %d. ", MAX_STACK);
-        break;
+        return n + snprintf(buf + n, cap - n, "Stack overflow! Reach limit of %d. ", stack_size);
+    case ERR_BACK_OVERFLOW:
+        return n + snprintf(buf + n, cap - n, "Back stack overflow! Reach limit of %d. ", backstack_size);
     case ERR_UNDERFLOW:
-        printf("Stack underflow. ");
-        break;
+        return n + snprintf(buf + n, cap - n, "Stack underflow. ");
+    case ERR_OUT_OF_MEMORY:
+        return n + snprintf(buf + n, cap - n, "Out of memory! Reach limit of %zu bytes. ", heap_size);
     default:
-        break;
+        return n;
     }
+}
 
-    vprintf(msg, list);
+void error(ErrorType type, Op op, const char *msg, ...) {
+    va_list list;
+    va_start(list, msg);
+
+    char prefix[PATH_MAX + 128];
+    error_prefix(prefix, sizeof(prefix), type, op);
+    fprintf(run_out(), "%s", prefix);
+
+    vfprintf(run_out(), msg, list);
 
     va_end(list);
 
     // FIXME: This leaks all the memory not fread. Let it leek?
-    exit(1);
+    fail(1);
 }
 
 // :linker
 
+// Links every loop/do/end and if/else/endif in one pass. Open loops and ifs
+// are kept on two stacks, they nest independently of each other. When the
+// program is malformed the error of the first broken construct is reported.
 void control_flow_link(VM *vm) {
-    int ip = 0;
+    IntList loops = {0}, dos = {0};
+    IntList ifs = {0}, elses = {0};
+    int err_at = INT_MAX;
+    ErrorType err = ERR_NO_DO;
 
-    while (vm->prog.data[ip].t != OP_NOP) {
+    int ip = 0;
+    for (; vm->prog.data[ip].t != OP_NOP; ip++) {
         Op op = vm->prog.data[ip];
-        if (op.t != OP_INTRINSIC) {
-            ip++;
+        if (op.t != OP_INTRINSIC)
             continue;
-        }
-
-        if (is_intrinsic(op, W_LOOP)) {
-            int loopIp = ip;
-            int doIp = -1;
-            int end = ip + 1;
-
-            int loopCnt = 1;
-            while (loopCnt > 0) {
-                Op endOP = vm->prog.data[end];
-                if (endOP.t == OP_NOP)
-                    error(ERR_UNCLOSED_LOOP, endOP, "`do` requires an `end` keyword.\n");
-
-                if (is_intrinsic(endOP, W_DO) && doIp == -1)
-                    doIp = end;
-
-                if (is_intrinsic(endOP, W_LOOP))
-                    loopCnt++;
-                if (is_intrinsic(endOP, W_END)) {
-                    loopCnt--;
-                    if (loopCnt == 0)
-                        break;
-                }
-                end++;
-            }
 
-            if (doIp == -1)
-                error(ERR_NO_DO, vm->prog.data[loopIp], "`do` keyword not found.\n");
-
-            vm->prog.data[doIp].link = end + 1;
-            vm->prog.data[end].link = loopIp;
-
-        } else if (is_intrinsic(op, W_IF)) {
-            int ifIp = ip;
-            int end = ip + 1;
-            int elseIp = -1;
-
-            int ifCnt = 1;
-            while (ifCnt > 0) {
-                Op endOP = vm->prog.data[end];
-                if (endOP.t == OP_NOP)
-                    error(ERR_UNCLOSED_IF, endOP, "`if` requires and `endif` keyword\n");
-
-                if (is_intrinsic(endOP, W_IF))
-                    ifCnt++;
-                if (is_intrinsic(endOP, W_ELSE) && ifCnt == 1)
-                    elseIp = end;
-                if (is_intrinsic(endOP, W_ENDIF)) {
-                    ifCnt--;
-                    if (ifCnt == 0)
-                        break;
-                }
-                end++;
+        switch (op.op) {
+        case W_LOOP:
+            VEC_ADD(&loops, ip);
+            VEC_ADD(&dos, -1);
+            break;
+        case W_DO:
+            if (dos.cnt > 0 && VEC_GET(dos, dos.cnt - 1) == -1)
+                VEC_GET(dos, dos.cnt - 1) = ip;
+            break;
+        case W_END: {
+            if (loops.cnt == 0)
+                break;
+            int loopIp = VEC_GET(loops, --loops.cnt);
+            int doIp = VEC_GET(dos, --dos.cnt);
+            if (doIp == -1) {
+                if (loopIp < err_at)
+                    err_at = loopIp, err = ERR_NO_DO;
+                break;
             }
-
+            vm->prog.data[doIp].link = ip + 1;
+            vm->prog.data[ip].link = loopIp;
+        } break;
+        case W_IF:
+            VEC_ADD(&ifs, ip);
+            VEC_ADD(&elses, -1);
+            break;
+        case W_ELSE:
+            if (elses.cnt > 0)
+                VEC_GET(elses, elses.cnt - 1) = ip;
+            break;
+        case W_ENDIF: {
+            if (ifs.cnt == 0)
+                break;
+            int ifIp = VEC_GET(ifs, --ifs.cnt);
+            int elseIp = VEC_GET(elses, --elses.cnt);
             if (elseIp != -1) {
                 vm->prog.data[ifIp].link = elseIp + 1;
-                vm->prog.data[elseIp].link = end + 1;
+                vm->prog.data[elseIp].link = ip + 1;
             } else {
-                vm->prog.data[ifIp].link = end + 1;
+                vm->prog.data[ifIp].link = ip + 1;
             }
+        } break;
+        default:
+            break;
         }
-        ip++;
     }
+
+    // The bottom of each stack is its first construct left open.
+    if (loops.cnt > 0 && VEC_GET(loops, 0) < err_at)
+        err_at = VEC_GET(loops, 0), err = ERR_UNCLOSED_LOOP;
+    if (ifs.cnt > 0 && VEC_GET(ifs, 0) < err_at)
+        err_at = VEC_GET(ifs, 0), err = ERR_UNCLOSED_IF;
+
+    VEC_FREE(loops);
+    VEC_FREE(dos);
+    VEC_FREE(ifs);
+    VEC_FREE(elses);
+
+    if (err_at == INT_MAX)
+        return;
+    if (err == ERR_NO_DO)
+        error(ERR_NO_DO, vm->prog.data[err_at], "`do` keyword not found.\n");
+    if (err == ERR_UNCLOSED_LOOP)
+        error(ERR_UNCLOSED_LOOP, vm->prog.data[ip], "`do` requires an `end` keyword.\n");
+    error(ERR_UNCLOSED_IF, vm->prog.data[ip], "`if` requires and `endif` keyword\n");
+}
+
+// Ops whose `link` is an op index.
+bool has_link(Op o) {
+    return is_intrinsic(o, W_DO) || is_intrinsic(o, W_END) || is_intrinsic(o, W_IF) || is_intrinsic(o, W_ELSE) || o.t == OP_CMP_DO;
+}
+
+// Ops after which execution doesn't simply go on with the next op.
+bool ends_block(Op o) {
+    return has_link(o) || o.t == OP_NOP || (o.t == OP_LIBC && libc_funcs[o.op].noreturn);
+}
+
+// Splits the linked program into basic blocks. A block starts at the first
+// op, at every jump target and after every op ending one. `end` and `else`
+// only jump, `do`, `if` and OP_CMP_DO also fall through, the final OP_NOP and
+// noreturn libc calls go nowhere. The optimizer, the stack verifier and the
+// backends all read it instead of rescanning the links.
+Cfg build_cfg(Program p) {
+    Cfg cfg = {0};
+    cfg.is_target = calloc(p.cnt + 1, sizeof(bool));
+    cfg.block_of = malloc(sizeof(int) * (p.cnt + 1));
+    FOR_LIST(p) {
+        Op o = VEC_GET(p, i);
+        if (has_link(o))
+            cfg.is_target[o.link] = true;
+    }
+
+    FOR_LIST(p) {
+        if (i == 0 || cfg.is_target[i] || ends_block(VEC_GET(p, i - 1))) {
+            if (cfg.blocks.cnt > 0)
+                VEC_GET(cfg.blocks, cfg.blocks.cnt - 1).end = i;
+            VEC_ADD(&cfg.blocks, ((Block){.start = i, .end = p.cnt}));
+        }
+        cfg.block_of[i] = cfg.blocks.cnt - 1;
+    }
+    cfg.block_of[p.cnt] = -1;
+
+    for (int b = 0; b < cfg.blocks.cnt; b++) {
+        Block *blk = &VEC_GET(cfg.blocks, b);
+        Op last = VEC_GET(p, blk->end - 1);
+        bool falls = !is_intrinsic(last, W_END) && !is_intrinsic(last, W_ELSE) && last.t != OP_NOP && !(last.t == OP_LIBC && libc_funcs[last.op].noreturn);
+        if (falls && blk->end < p.cnt)
+            VEC_ADD(&blk->succ, b + 1);
+        if (has_link(last) && cfg.block_of[last.link] != -1)
+            VEC_ADD(&blk->succ, cfg.block_of[last.link]);
+    }
+    for (int b = 0; b < cfg.blocks.cnt; b++) {
+        Block blk = VEC_GET(cfg.blocks, b);
+        FOR_LIST(blk.succ) {
+            VEC_ADD(&VEC_GET(cfg.blocks, VEC_GET(blk.succ, i)).pred, b);
+        }
+    }
+    return cfg;
+}
+
+void free_cfg(Cfg *cfg) {
+    FOR_LIST(cfg->blocks) {
+        VEC_FREE(VEC_GET(cfg->blocks, i).succ);
+        VEC_FREE(VEC_GET(cfg->blocks, i).pred);
+    }
+    VEC_FREE(cfg->blocks);
+    free(cfg->block_of);
+    free(cfg->is_target);
+    *cfg = (Cfg){0};
 }
 
 // ;linker
@@ -966,7 +1663,7 @@ void control_flow_link(VM *vm) {
 char *op_to_syntax(Op op) {
     static_assert(BT_COUNT == 8, "Implement newly added BinopType");
     static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
-    static_assert(OP_COUNT == 13, "Implement newly added OpType");
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
     switch (op.t) {
     case OP_BINOP: {
         switch (op.op) {
@@ -1030,6 +1727,18 @@ char *op_to_syntax(Op op) {
         return "<-";
     case OP_POP:
         return "->";
+    case OP_LIBC:
+        return (char *)libc_funcs[op.op].name;
+    case OP_LOAD:
+        return "deref";
+    case OP_STORE:
+        return "w64_mem";
+    case OP_BINOP_IMM:
+        return op_to_syntax((Op){.t = OP_BINOP, .op = op.sub});
+    case OP_CMP_DO:
+        return "do";
+    case OP_PUTD_CHAR:
+        return "sout";
     default:
         return "Unknown type";
     }
@@ -1041,162 +1750,161 @@ void can_pop_amount(int sp, long amt, Op o) {
         error(ERR_UNDERFLOW, o, "`%s` requires at least %d value(s) on the stack.\n", op_to_syntax(o), amt);
 }
 
+// can_pop_amount for the engines, the Op is only read when it fails.
+static inline void need(int sp, long amt, const Op *o) {
+    if (sp < amt)
+        can_pop_amount(sp, amt, *o);
+}
+
 long pop(long *stack, int *sp) {
     return stack[--(*sp)];
 }
 
-void try_push(long *stack, int *sp, long operand, Op o) {
-    if (*sp + 1 >= MAX_STACK)
-        error(ERR_OVERFLOW, o, "Can't push literal number %d\n", operand);
+// No limit check, pushing past it faults on the guard page, see :guard.
+void push(long *stack, int *sp, long operand) {
     stack[(*sp)++] = operand;
 }
 
-void interpet_binop(long *stack, int *sp, Op o) {
+// Reports an overflow found at run time, when the value that didn't fit is
+// no longer known.
+void overflow_error(Op o) {
+    if (o.t == OP_LIT_NUMBER || o.t == OP_LIT_STR)
+        error(ERR_OVERFLOW, o, "Can't push literal number %d\n", o.op);
+    error(ERR_OVERFLOW, o, "`%s` can't push more value(s).\n", op_to_syntax(o));
+}
+
+// 32 bit `+ - *` wrap around. Done in unsigned, signed overflow is undefined.
+#define WRAP(a, op, b) ((int)((unsigned)(a) op (unsigned)(b)))
+
+long binop_eval(BinopType type, int top, int ut) {
+    static_assert(BT_COUNT == 8, "Implement newly added BinopType");
+    switch (type) {
+    case BT_PLUS:
+        return WRAP(top, +, ut);
+    case BT_MINUS:
+        return WRAP(top, -, ut);
+    case BT_MULT:
+        return WRAP(top, *, ut);
+    case BT_DIV:
+        return top / ut;
+    case BT_MOD:
+        return top % ut;
+    case BT_LT:
+        return top < ut;
+    case BT_GT:
+        return top > ut;
+    case BT_EQ:
+        return top == ut;
+    default:
+        return 0;
+    }
+}
+
+void interpet_binop(long *stack, int *sp, Inst in, const Op *o) {
     static_assert(BT_COUNT == 8, "Implement newly added BinopType");
 
-    can_pop_amount(*sp, 2, o);
+    need(*sp, 2, o);
 
     int top = pop(stack, sp);
     int ut = pop(stack, sp);
 
-    switch (o.op) {
+    switch (in.op) {
     case BT_PLUS:
-        try_push(stack, sp, top + ut, o);
+        push(stack, sp, WRAP(top, +, ut));
         break;
     case BT_MINUS:
-        try_push(stack, sp, top - ut, o);
+        push(stack, sp, WRAP(top, -, ut));
         break;
     case BT_MULT:
-        try_push(stack, sp, top * ut, o);
+        push(stack, sp, WRAP(top, *, ut));
         break;
     case BT_DIV:
-        try_push(stack, sp, top / ut, o);
+        push(stack, sp, top / ut);
         break;
     case BT_MOD:
-        try_push(stack, sp, top % ut, o);
+        push(stack, sp, top % ut);
         break;
     case BT_LT:
-        try_push(stack, sp, top < ut, o);
+        push(stack, sp, top < ut);
         break;
     case BT_GT:
-        try_push(stack, sp, top > ut, o);
+        push(stack, sp, top > ut);
         break;
     case BT_EQ:
-        try_push(stack, sp, top == ut, o);
+        push(stack, sp, top == ut);
         break;
     }
 }
 
-void interpet_libc_call(long *stack, int *sp, int *ip, Op o, ProgramRun *prog) {
-    _ ip;
-
-    size_t to_check = VEC_GET(prog->tokens, o.index).lit_ptr;
-    if (str_eq(to_check, "open")) {
-        long path_id = pop(stack, sp);
-        long mode = pop(stack, sp);
-
-        char *path = prog->vm.mem + path_id;
-        int fd = open(path, mode);
-        try_push(stack, sp, fd, o);
-    } else if (str_eq(to_check, "close")) {
-        long fd = pop(stack, sp);
-
-        close(fd);
-    } else if (str_eq(to_check, "lseek")) {
-        long fd = pop(stack, sp);
-        long off = pop(stack, sp);
-        long whence = pop(stack, sp);
+void interpet_libc_call(long *stack, int *sp, Inst in, const Op *o, ProgramRun *prog) {
+    LibcFunc f = libc_funcs[in.op];
+    need(*sp, f.arity, o);
 
-        off_t i = lseek(fd, off, whence);
+    long args[LIBC_MAX_ARITY];
+    for (int i = 0; i < f.arity; i++)
+        args[i] = pop(stack, sp);
 
-        try_push(stack, sp, i, o);
-    } else if (str_eq(to_check, "malloc")) {
-        int size = pop(stack, sp);
-        long addr = (long)malloc(size);
-        try_push(stack, sp, addr, o);
-    } else if (str_eq(to_check, "read")) {
-        long fd = pop(stack, sp);
-        long addr = pop(stack, sp);
-        long size = pop(stack, sp);
-
-        read(fd, (void *)addr, size);
-    } else if (str_eq(to_check, "free")) {
-        long ptr = pop(stack, sp);
-        free((void *)ptr);
-    } else if (str_eq(to_check, "exit")) {
-        int code = pop(stack, sp);
-        exit(code);
-    }
+    long ret = f.call(prog, args);
+    if (f.returns)
+        push(stack, sp, ret);
 }
 
-void interpet_intrinsic(long *stack, int *sp, int *ip, Op o, ProgramRun *prog) {
-    switch (o.op) {
+void interpet_intrinsic(long *stack, int *sp, int *ip, Inst in, const Op *o, ProgramRun *prog) {
+    switch (in.op) {
     case W_DEFINED: {
-        if (is_libc_word(*prog, o)) {
-            interpet_libc_call(stack, sp, ip, o, prog);
-        } else {
-            int def_id = find_defined(*prog, o);
-            if (def_id == -1) {
-                printf("Something went wrong!\n");
-            }
-            if (prog->vm.constData[def_id] != -1) {
-                try_push(stack, sp, prog->vm.constData[def_id], o);
-            } else {
-                try_push(stack, sp, def_id, o);
-            }
-        }
-        *ip += 1;
+        // Every defined word is replaced by its value before execution.
+        assert(false && "unreachable");
     } break;
     case W_PUTD: {
-        can_pop_amount(*sp, 1, o);
+        need(*sp, 1, o);
         long top = pop(stack, sp);
-        printf("%ld", top);
+        fprintf(prog->out, "%ld", top);
         *ip += 1;
     } break;
     case W_LOOP: {
         *ip += 1;
     } break;
     case W_END: {
-        *ip = o.link;
+        *ip = in.link;
     } break;
     case W_DO: {
-        can_pop_amount(*sp, 1, o);
+        need(*sp, 1, o);
         long top = pop(stack, sp);
         if (top)
             *ip += 1;
         else
-            *ip = o.link;
+            *ip = in.link;
     } break;
     case W_PUTC: {
-        can_pop_amount(*sp, 1, o);
+        need(*sp, 1, o);
         int top = pop(stack, sp);
-        printf("%c", top);
+        fprintf(prog->out, "%c", top);
         *ip += 1;
     } break;
     case W_PRINTLN: {
-        can_pop_amount(*sp, 1, o);
+        need(*sp, 1, o);
         long top = pop(stack, sp);
         char *str = prog->vm.mem + top;
-        printf("%s\n", str);
+        fprintf(prog->out, "%s\n", str);
         *ip += 1;
     } break;
     case W_PRINT: {
-        can_pop_amount(*sp, 1, o);
+        need(*sp, 1, o);
         long top = pop(stack, sp);
         char *str = prog->vm.mem + top;
-        printf("%s", str);
+        fprintf(prog->out, "%s", str);
         *ip += 1;
     } break;
     case W_IF: {
-        can_pop_amount(*sp, 1, o);
+        need(*sp, 1, o);
         long top = pop(stack, sp);
         if (top)
             *ip += 1;
         else
-            *ip = o.link;
+            *ip = in.link;
     } break;
     case W_ELSE: {
-        *ip = o.link;
+        *ip = in.link;
     } break;
     case W_ENDIF: {
         *ip += 1;
@@ -1204,18 +1912,10 @@ void interpet_intrinsic(long *stack, int *sp, int *ip, Op o, ProgramRun *prog) {
     case W_MEM: {
         assert(false && "unreachable");
     } break;
-    case W_W_MEM: {
-        can_pop_amount(*sp, 2, o);
-        long defined_id = pop(stack, sp);
-        long val = pop(stack, sp);
-        long off = prog->vm.definedData[defined_id];
-
-        memcpy(prog->vm.mem + off, &val, sizeof(long));
-
-        *ip += 1;
-    } break;
+    // A `mem` name already stands for its offset, `w_mem` stores like `w64_mem`.
+    case W_W_MEM:
     case W_W_MEM64: {
-        can_pop_amount(*sp, 2, o);
+        need(*sp, 2, o);
         long ptr = pop(stack, sp);
         long val = pop(stack, sp);
 
@@ -1225,23 +1925,25 @@ void interpet_intrinsic(long *stack, int *sp, int *ip, Op o, ProgramRun *prog) {
     } break;
 
     case W_DEREF: {
-        can_pop_amount(*sp, 2, o);
+        need(*sp, 2, o);
         long ptr = pop(stack, sp);
         long size = pop(stack, sp);
 
-        long at;
+        long at = 0;
         memcpy(&at, prog->vm.mem + ptr, size);
-        try_push(stack, sp, at, o);
+        push(stack, sp, at);
 
         *ip += 1;
     } break;
     case W_AS_STR: {
-        can_pop_amount(*sp, 2, o);
+        need(*sp, 2, o);
         long ptr = pop(stack, sp);
         long size = pop(stack, sp);
 
-        size_t temp_ptr = cstr_cpy((void *)ptr, size);
-        try_push(stack, sp, push_str_to_mem(&prog->vm, temp_ptr), o);
+        long str = push_str_to_mem(&prog->vm, (void *)ptr, size);
+        if (str == -1)
+            error(ERR_OUT_OF_MEMORY, *o, "`as_str` can't copy %d bytes.\n", size);
+        push(stack, sp, str);
 
         *ip += 1;
     } break;
@@ -1252,195 +1954,4626 @@ void interpet_intrinsic(long *stack, int *sp, int *ip, Op o, ProgramRun *prog) {
         assert(false && "unreachable");
     } break;
     default:
-        printf("Word not handled %s %s\n", op_to_str(o), TOKEN_LIT(*prog, o.index));
-        exit(1);
+        fprintf(run_out(), "Word not handled %s %s\n", op_to_str(*o), TOKEN_LIT(*prog, o->index));
+        fail(1);
     }
 }
 
-bool interpet(ProgramRun *prog) {
-    long stack[MAX_STACK] = {0};
-    int sp = 0;
-    long backStack[MAX_STACK] = {0};
-    int bsp = 0;
-
-    VM vm = prog->vm;
+void dump_stack(FILE *out, long *stack, int sp) {
+    fprintf(out, "> Stack Dump:\n");
+    for (int j = 0; j < sp; j++) {
+        fprintf(out, "[%d] %ld\n", j, stack[j]);
+    }
+    fprintf(out, "< End Stack Dump.\n");
+}
 
-    static_assert(OP_COUNT == 13, "Implement newly added OpType");
-    int ip = 0;
-    while (VEC_GET(vm.prog, ip).t != OP_NOP) {
-        Op o = VEC_GET(vm.prog, ip);
-        switch (o.t) {
-        case OP_BINOP: {
-            interpet_binop(stack, &sp, o);
-            ip++;
-        } break;
-        case OP_LIT_NUMBER:
-        case OP_LIT_STR: {
-            try_push(stack, &sp, o.op, o);
-            ip++;
-        } break;
-        case OP_INTRINSIC: {
-            interpet_intrinsic(stack, &sp, &ip, o, prog);
-        } break;
-        case OP_DUMP: {
-            printf("> Stack Dump:\n");
-            for (int j = 0; j < sp; j++) {
-                printf("[%d] %ld\n", j, stack[j]);
-            }
-            printf("< End Stack Dump.\n");
-            ip++;
-        } break;
-        case OP_BDUMP: {
-            printf("> Back Stack Dump:\n");
-            for (int j = 0; j < sp; j++) {
-                printf("[%d] %ld\n", j, backStack[j]);
-            }
-            printf("< End Back Stack Dump.\n");
-            ip++;
-        } break;
-        case OP_DUP: {
-            can_pop_amount(sp, 1, o);
-            try_push(stack, &sp, stack[sp - 1], o);
-            ip++;
-        } break;
-        case OP_2DUP: {
-            can_pop_amount(sp, 2, o);
-            long top = stack[sp - 1];
-            long ut = stack[sp - 2];
-            try_push(stack, &sp, ut, o);
-            try_push(stack, &sp, top, o);
-            ip++;
-        } break;
-        case OP_DROP: {
-            can_pop_amount(sp, 1, o);
-            pop(stack, &sp);
-            ip++;
-        } break;
-        case OP_SWAP: {
-            can_pop_amount(sp, 2, o);
-            long top = pop(stack, &sp);
-            long ut = pop(stack, &sp);
-            try_push(stack, &sp, top, o);
-            try_push(stack, &sp, ut, o);
-            ip++;
-        } break;
-        case OP_STASH: {
-            can_pop_amount(sp, 1, o);
-            long top = pop(stack, &sp);
-            if (sp - top < 0)
-                error(ERR_UNDERFLOW, o, "Trying to stash %d values on the stack, but only %d are available.\n", top, sp);
-            if (bsp + top >= MAX_STACK)
-                error(ERR_OVERFLOW, o, "Can't stash %d values on back stack.\n", top);
-
-            for (int n = 0; n < top; n++)
-                backStack[bsp++] = stack[--sp];
-            ip++;
-        } break;
-        case OP_POP: {
-            can_pop_amount(sp, 1, o);
-            long top = pop(stack, &sp);
-            if (bsp - top < 0)
-                error(ERR_UNDERFLOW, o, "Trying to pop %d values from the back stack, but only %d are available.\n", top, sp);
-            if (sp + top >= MAX_STACK)
-                error(ERR_OVERFLOW, o, "Can't pop %d values on stack.\n", top);
-
-            for (int n = 0; n < top; n++)
-                stack[sp++] = backStack[--bsp];
-            ip++;
-        } break;
-        default: {
-        } break;
-        }
+void dump_back_stack(FILE *out, long *backStack, int sp) {
+    fprintf(out, "> Back Stack Dump:\n");
+    for (int j = 0; j < sp; j++) {
+        fprintf(out, "[%d] %ld\n", j, backStack[j]);
     }
+    fprintf(out, "< End Back Stack Dump.\n");
+}
 
+void interpet_stash(long *stack, int *sp, long *backStack, int *bsp, const Op *o) {
+    need(*sp, 1, o);
+    long top = pop(stack, sp);
+    if (*sp - top < 0)
+        error(ERR_UNDERFLOW, *o, "Trying to stash %d values on the stack, but only %d are available.\n", top, *sp);
+    if (*bsp + top >= backstack_size)
+        error(ERR_BACK_OVERFLOW, *o, "Can't stash %d values on back stack.\n", top);
+
+    for (int n = 0; n < top; n++)
+        backStack[(*bsp)++] = stack[--(*sp)];
+}
+
+void interpet_pop(long *stack, int *sp, long *backStack, int *bsp, const Op *o) {
+    need(*sp, 1, o);
+    long top = pop(stack, sp);
+    if (*bsp - top < 0)
+        error(ERR_UNDERFLOW, *o, "Trying to pop %d values from the back stack, but only %d are available.\n", top, *sp);
+    if (*sp + top >= stack_size)
+        error(ERR_OVERFLOW, *o, "Can't pop %d values on stack.\n", top);
+
+    for (int n = 0; n < top; n++)
+        stack[(*sp)++] = backStack[--(*bsp)];
+}
+
+void check_unhandled_data(FILE *out, long *stack, int sp) {
     if (sp != 0) {
         // TODO: Move this to error() ?
-        printf("E: Unhandled data on the stack.\n");
+        fprintf(out, "E: Unhandled data on the stack.\n");
         for (int i = sp - 1; i >= 0; i--) {
-            printf("[%d] %ld\n", i, stack[i]);
+            fprintf(out, "[%d] %ld\n", i, stack[i]);
         }
     }
+}
 
-    return true;
+// :guard
+// Stacks are mapped with a PROT_NONE page right after their last usable
+// slot, so the checked engines push without comparing against the limit.
+// The first push past it faults and guard_handler reports it through error()
+// on the op that was running, which the engines record in guard_state.
+typedef struct {
+    ProgramRun *prog; // NULL outside a checked run
+    int ip;
+    char *guard; // the data stack's guard page
+} GuardState;
+
+// SIGSEGV is delivered to the faulting thread.
+static _Thread_local GuardState guard_state;
+
+size_t stack_map_len(int size, int lead, size_t page) {
+    size_t used = sizeof(long) * (size - 1 + lead);
+    return (used + page - 1) / page * page + page;
 }
 
-// ;interpet
+// Maps `size` slots, `lead` more usable below slot 0, the pages are only
+// backed once touched.
+long *stack_map(int size, int lead) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = stack_map_len(size, lead, page);
+    char *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        fprintf(run_out(), "E: Can't map a stack of %d values.\n", size);
+        fail(1);
+    }
+    track_map(map, len);
+    char *guard = map + len - page;
+    mprotect(guard, page, PROT_NONE);
+    return (long *)guard - (size - 1);
+}
 
-void clean_program_run(ProgramRun *prog) {
-    VEC_FREE(prog->vm.definedTable);
-    VEC_FREE(prog->vm.prog);
-    VEC_FREE(prog->tokens);
-    VEC_FREE(prog->defines);
-    free(prog->code);
+void stack_unmap(long *stack, int size, int lead) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = stack_map_len(size, lead, page);
+    char *guard = (char *)(stack + size - 1);
+    untrack_map(guard + page - len);
+    munmap(guard + page - len, len);
 }
 
-ProgramRun run_program(const char *path) {
-    size_t len;
-    char *code = read_file_as_cstr(path, &len);
-    if (code == NULL)
-        exit(1);
+void guard_handler(int sig, siginfo_t *info, void *uctx) {
+    _ uctx;
+    GuardState g = guard_state;
+    char *addr = info->si_addr;
+    if (g.prog == NULL || addr < g.guard || addr >= g.guard + sysconf(_SC_PAGESIZE)) {
+        // Not ours, crash as if there was no handler.
+        signal(sig, SIG_DFL);
+        return;
+    }
+    // error() isn't async-signal-safe, the fault always comes from a push in
+    // the engine itself though, never from inside libc.
+    overflow_error(VEC_GET(g.prog->vm.prog, g.ip));
+}
 
-    ProgramRun res = {0};
-    res.code = code;
-    bench b = {0};
-    BENCH_START(&b);
-    tokenize(code, len, path, &res.tokens);
-    MEASURE(&b, "Tokenize");
+void guard_install(void) {
+    struct sigaction sa = {0};
+    sa.sa_sigaction = guard_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+}
 
-    memset(res.vm.constData, -1, sizeof(int) * MAX_DEFINED);
-    parse(&res);
-    MEASURE(&b, "Parse tokens");
+void guard_enter(ProgramRun *prog, long *stack) {
+    static pthread_once_t installed = PTHREAD_ONCE_INIT;
+    pthread_once(&installed, guard_install);
+    guard_state = (GuardState){prog, 0, (char *)(stack + stack_size - 1)};
+}
 
-    process_include(&res);
+void guard_leave(void) {
+    guard_state.prog = NULL;
+}
 
-#ifdef DEBUG
-    // print_operations(vm);
-#endif
-    BENCH_START(&b);
-    replace_defined(&res);
+// Cleans up after a run fail() unwound out of.
+void release_run(void) {
+    guard_leave();
+    for (int i = 0; i < RUN_MAPS; i++) {
+        if (run_ctx.maps[i].at != NULL)
+            munmap(run_ctx.maps[i].at, run_ctx.maps[i].len);
+        run_ctx.maps[i].at = NULL;
+    }
+}
+// ;guard
+
+void trace_op(ProgramRun *prog, int ip);
+void count_op(ProgramRun *prog, int ip, int sp, int bsp);
+void profile_op(ProgramRun *prog, int ip);
+void profile_stop(ProgramRun *prog);
+
+// Runs the op at `ip` with every check, returns the next ip.
+static inline __attribute__((always_inline)) int step_op(ProgramRun *prog, int ip, long *stack, int *sp, long *backStack, int *bsp) {
+    Inst in = prog->vm.code[ip];
+    // Only read when reporting an error.
+    const Op *o = &VEC_GET(prog->vm.prog, ip);
+    guard_state.ip = ip;
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
+    switch (in.t) {
+    case OP_BINOP: {
+        interpet_binop(stack, sp, in, o);
+        ip++;
+    } break;
+    case OP_LIT_NUMBER:
+    case OP_LIT_STR: {
+        push(stack, sp, in.op);
+        ip++;
+    } break;
+    case OP_INTRINSIC: {
+        interpet_intrinsic(stack, sp, &ip, in, o, prog);
+    } break;
+    case OP_DUMP: {
+        dump_stack(prog->out, stack, *sp);
+        ip++;
+    } break;
+    case OP_BDUMP: {
+        dump_back_stack(prog->out, backStack, *sp);
+        ip++;
+    } break;
+    case OP_DUP: {
+        need(*sp, 1, o);
+        push(stack, sp, stack[*sp - 1]);
+        ip++;
+    } break;
+    case OP_2DUP: {
+        need(*sp, 2, o);
+        long top = stack[*sp - 1];
+        long ut = stack[*sp - 2];
+        push(stack, sp, ut);
+        push(stack, sp, top);
+        ip++;
+    } break;
+    case OP_DROP: {
+        need(*sp, 1, o);
+        pop(stack, sp);
+        ip++;
+    } break;
+    case OP_SWAP: {
+        need(*sp, 2, o);
+        long top = pop(stack, sp);
+        long ut = pop(stack, sp);
+        push(stack, sp, top);
+        push(stack, sp, ut);
+        ip++;
+    } break;
+    case OP_STASH: {
+        interpet_stash(stack, sp, backStack, bsp, o);
+        ip++;
+    } break;
+    case OP_POP: {
+        interpet_pop(stack, sp, backStack, bsp, o);
+        ip++;
+    } break;
+    case OP_LIBC: {
+        interpet_libc_call(stack, sp, in, o, prog);
+        ip++;
+    } break;
+    case OP_LOAD: {
+        long at = 0;
+        memcpy(&at, prog->vm.mem + in.op, in.sub);
+        push(stack, sp, at);
+        ip++;
+    } break;
+    case OP_STORE: {
+        need(*sp, 1, o);
+        long val = pop(stack, sp);
+        memcpy(prog->vm.mem + in.op, &val, sizeof(long));
+        ip++;
+    } break;
+    case OP_BINOP_IMM: {
+        need(*sp, 1, o);
+        stack[*sp - 1] = binop_eval(in.sub, in.op, stack[*sp - 1]);
+        ip++;
+    } break;
+    case OP_CMP_DO: {
+        need(*sp, 1, o);
+        if (binop_eval(in.sub, in.op, stack[*sp - 1]))
+            ip++;
+        else
+            ip = in.link;
+    } break;
+    case OP_PUTD_CHAR: {
+        need(*sp, 1, o);
+        fprintf(prog->out, "%ld%c", pop(stack, sp), (int)in.op);
+        ip++;
+    } break;
+    default: {
+    } break;
+    }
+    return ip;
+}
 
-    MEASURE(&b, "Constant fold");
-    BENCH_START(&b);
-    control_flow_link(&res.vm);
-    MEASURE(&b, "ControlFlowLink");
+typedef enum {
+    HOOK_NONE = 0,
+    HOOK_TRACE, // --seq-profile
+    HOOK_COUNT, // --stats
+    HOOK_PROFILE, // --profile
+} Hook;
+
+// Instantiated once per hook so the hooks cost nothing when they are off.
+static inline __attribute__((always_inline)) bool switch_loop(ProgramRun *prog, const Hook hook) {
+    long *stack = stack_map(stack_size, 0);
+    int sp = 0;
+    long *backStack = stack_map(backstack_slots(), 0);
+    int bsp = 0;
 
-#ifdef DEBUG
-    print_operations(res);
-#endif
+    guard_enter(prog, stack);
+    int ip = 0;
+    while (prog->vm.code[ip].t != OP_NOP) {
+        if (hook == HOOK_TRACE)
+            trace_op(prog, ip);
+        if (hook == HOOK_PROFILE)
+            profile_op(prog, ip);
+        int next = step_op(prog, ip, stack, &sp, backStack, &bsp);
+        if (hook == HOOK_COUNT)
+            count_op(prog, ip, sp, bsp);
+        ip = next;
+    }
+    if (hook == HOOK_PROFILE)
+        profile_stop(prog);
+    guard_leave();
 
-    BENCH_START(&b);
-    interpet(&res);
-    MEASURE(&b, "Interpet");
+    check_unhandled_data(prog->out, stack, sp);
 
-    return res;
+    stack_unmap(stack, stack_size, 0);
+    stack_unmap(backStack, backstack_slots(), 0);
+    return true;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2)
-        return 1;
+bool interpet_switch(ProgramRun *prog) {
+    if (prog->seq != NULL)
+        return switch_loop(prog, HOOK_TRACE);
+    if (prog->profile != NULL)
+        return switch_loop(prog, HOOK_PROFILE);
+    if (prog->counts != NULL)
+        return switch_loop(prog, HOOK_COUNT);
+    return switch_loop(prog, HOOK_NONE);
+}
 
-    _ *argv++;
+void stash_unchecked(long *stack, int *sp, long *backStack, int *bsp) {
+    long top = stack[--(*sp)];
+    for (int n = 0; n < top; n++)
+        backStack[(*bsp)++] = stack[--(*sp)];
+}
 
-    const char *path = *argv++;
+void pop_unchecked(long *stack, int *sp, long *backStack, int *bsp) {
+    long top = stack[--(*sp)];
+    for (int n = 0; n < top; n++)
+        stack[(*sp)++] = backStack[--(*bsp)];
+}
 
-    bool gen = false;
-    if (argc == 3) {
-        const char *genArg = *argv++;
-        if (strncmp(genArg, "gen", 3) == 0)
-            gen = true;
+void libc_call_unchecked(long *stack, int *sp, Inst in, ProgramRun *prog) {
+    LibcFunc f = libc_funcs[in.op];
+    long args[LIBC_MAX_ARITY];
+    for (int i = 0; i < f.arity; i++)
+        args[i] = stack[--(*sp)];
+    long ret = f.call(prog, args);
+    if (f.returns)
+        stack[(*sp)++] = ret;
+}
+
+// Direct-threaded engine: the program is translated once into an array of
+// handler addresses and every handler ends in its own indirect jump.
+// Each handler has a checked entry `c_*` doing the bounds checks that falls
+// through into its body `t_*`. Programs proven by verify_stack are threaded
+// through the bodies only.
+typedef struct Thread {
+    void *h;
+    long op;
+    struct Thread *target;
+} Thread;
+
+typedef struct {
+    void *checked;
+    void *unchecked;
+} Handler;
+
+bool interpet_threaded(ProgramRun *prog) {
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
+    static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
+    static_assert(BT_COUNT == 8, "Implement newly added BinopType");
+
+#define HANDLER(name) \
+    (Handler) { &&c_##name, &&t_##name }
+
+    Handler ops[OP_COUNT] = {
+        [OP_NOP] = HANDLER(halt),
+        [OP_LIT_NUMBER] = HANDLER(lit),
+        [OP_LIT_STR] = HANDLER(lit),
+        [OP_DUMP] = HANDLER(dump),
+        [OP_BDUMP] = HANDLER(bdump),
+        [OP_DUP] = HANDLER(dup),
+        [OP_2DUP] = HANDLER(2dup),
+        [OP_DROP] = HANDLER(drop),
+        [OP_SWAP] = HANDLER(swap),
+        [OP_STASH] = HANDLER(stash),
+        [OP_POP] = HANDLER(pop),
+        [OP_LIBC] = HANDLER(libc),
+        [OP_LOAD] = HANDLER(load),
+        [OP_STORE] = HANDLER(store),
+        [OP_PUTD_CHAR] = HANDLER(putd_char),
+    };
+    Handler binops[BT_COUNT] = {
+        [BT_PLUS] = HANDLER(plus),
+        [BT_MINUS] = HANDLER(minus),
+        [BT_MULT] = HANDLER(mult),
+        [BT_DIV] = HANDLER(div),
+        [BT_MOD] = HANDLER(mod),
+        [BT_LT] = HANDLER(lt),
+        [BT_GT] = HANDLER(gt),
+        [BT_EQ] = HANDLER(eq),
+    };
+    Handler binops_imm[BT_COUNT] = {
+        [BT_PLUS] = HANDLER(plus_imm),
+        [BT_MINUS] = HANDLER(minus_imm),
+        [BT_MULT] = HANDLER(mult_imm),
+        [BT_DIV] = HANDLER(div_imm),
+        [BT_MOD] = HANDLER(mod_imm),
+        [BT_LT] = HANDLER(lt_imm),
+        [BT_GT] = HANDLER(gt_imm),
+        [BT_EQ] = HANDLER(eq_imm),
+    };
+    Handler cmp_dos[BT_COUNT] = {
+        [BT_PLUS] = HANDLER(plus_do),
+        [BT_MINUS] = HANDLER(minus_do),
+        [BT_MULT] = HANDLER(mult_do),
+        [BT_DIV] = HANDLER(div_do),
+        [BT_MOD] = HANDLER(mod_do),
+        [BT_LT] = HANDLER(lt_do),
+        [BT_GT] = HANDLER(gt_do),
+        [BT_EQ] = HANDLER(eq_do),
+    };
+    // Words without a handler of their own go through interpet_intrinsic.
+    Handler intrinsics[W_COUNT] = {
+        [W_DEFINED] = HANDLER(intrinsic),
+        [W_PUTD] = HANDLER(putd),
+        [W_LOOP] = HANDLER(next),
+        [W_END] = HANDLER(jump),
+        [W_MEM] = HANDLER(intrinsic),
+        [W_W_MEM] = HANDLER(intrinsic),
+        [W_W_MEM64] = HANDLER(w_mem64),
+        [W_DEREF] = HANDLER(deref),
+        [W_DO] = HANDLER(branch),
+        [W_PUTC] = HANDLER(putc),
+        [W_PRINTLN] = HANDLER(println),
+        [W_PRINT] = HANDLER(print),
+        [W_IF] = HANDLER(branch),
+        [W_ELSE] = HANDLER(jump),
+        [W_ENDIF] = HANDLER(next),
+        [W_AS_STR] = HANDLER(intrinsic),
+        [W_DEF] = HANDLER(intrinsic),
+        [W_INCLUDE] = HANDLER(intrinsic),
+    };
+#undef HANDLER
+
+    long *stack = stack_map(stack_size, 0);
+    int sp = 0;
+    long *backStack = stack_map(backstack_slots(), 0);
+    int bsp = 0;
+
+    bool checked = !prog->verified;
+    Thread *code = malloc(sizeof(Thread) * prog->vm.prog.cnt);
+    FOR_LIST(prog->vm.prog) {
+        Inst o = prog->vm.code[i];
+        Handler h = ops[o.t];
+        if (o.t == OP_BINOP)
+            h = binops[o.op];
+        else if (o.t == OP_INTRINSIC)
+            h = intrinsics[o.op];
+        else if (o.t == OP_BINOP_IMM)
+            h = binops_imm[o.sub];
+        else if (o.t == OP_CMP_DO)
+            h = cmp_dos[o.sub];
+        code[i] = (Thread){checked ? h.checked : h.unchecked, o.op, code + o.link};
     }
 
-    if (gen && system("qbe -h 1> /dev/null") != 0) {
-        printf("QBE backend not installed system wide.\n");
-        return 1;
+// The full Op is only looked up when reporting an error.
+#define T_OP VEC_GET(prog->vm.prog, t - code)
+#define T_IN prog->vm.code[t - code]
+#define DISPATCH() goto *t->h
+#define NEXT()      \
+    do {            \
+        t++;        \
+        DISPATCH(); \
+    } while (0)
+#define NEED(n)                            \
+    do {                                   \
+        if (sp < (n))                      \
+            can_pop_amount(sp, (n), T_OP); \
+    } while (0)
+// Checked handlers that push say where they are for guard_handler.
+#define MARK() guard_state.ip = t - code
+#define BINOP(name, expr)              \
+    c_##name : NEED(2);                \
+    t_##name : {                       \
+        int top = stack[--sp];         \
+        int ut = stack[--sp];          \
+        stack[sp++] = (expr);          \
+        NEXT();                        \
+    }                                  \
+    c_##name##_imm : NEED(1);          \
+    t_##name##_imm : {                 \
+        int top = t->op;               \
+        int ut = stack[sp - 1];        \
+        stack[sp - 1] = (expr);        \
+        NEXT();                        \
+    }                                  \
+    c_##name##_do : NEED(1);           \
+    t_##name##_do : {                  \
+        int top = t->op;               \
+        int ut = stack[sp - 1];        \
+        t = (expr) != 0 ? t + 1 : t->target; \
+        DISPATCH();                    \
     }
 
-    if (gen && system("clang --version 1> /dev/null") != 0) {
-        printf("Clang not installed system wide.\n");
-        return 1;
+    if (checked)
+        guard_enter(prog, stack);
+    Thread *t = code;
+    DISPATCH();
+
+    BINOP(plus, WRAP(top, +, ut));
+    BINOP(minus, WRAP(top, -, ut));
+    BINOP(mult, WRAP(top, *, ut));
+    BINOP(div, top / ut);
+    BINOP(mod, top % ut);
+    BINOP(lt, top < ut);
+    BINOP(gt, top > ut);
+    BINOP(eq, top == ut);
+
+c_lit:
+    MARK();
+t_lit:
+    stack[sp++] = t->op;
+    NEXT();
+c_next:
+t_next:
+    NEXT();
+c_jump:
+t_jump:
+    t = t->target;
+    DISPATCH();
+c_branch:
+    NEED(1);
+t_branch:
+    if (stack[--sp])
+        t++;
+    else
+        t = t->target;
+    DISPATCH();
+c_putd:
+    NEED(1);
+t_putd:
+    fprintf(prog->out, "%ld", stack[--sp]);
+    NEXT();
+c_putc:
+    NEED(1);
+t_putc:
+    fprintf(prog->out, "%c", (int)stack[--sp]);
+    NEXT();
+c_println:
+    NEED(1);
+t_println:
+    fprintf(prog->out, "%s\n", prog->vm.mem + stack[--sp]);
+    NEXT();
+c_print:
+    NEED(1);
+t_print:
+    fprintf(prog->out, "%s", prog->vm.mem + stack[--sp]);
+    NEXT();
+c_w_mem64:
+    NEED(2);
+t_w_mem64 : {
+    long ptr = stack[--sp];
+    long val = stack[--sp];
+    memcpy(prog->vm.mem + ptr, &val, sizeof(long));
+    NEXT();
+}
+c_deref:
+    NEED(2);
+t_deref : {
+    long ptr = stack[--sp];
+    long size = stack[--sp];
+    long at = 0;
+    memcpy(&at, prog->vm.mem + ptr, size);
+    stack[sp++] = at;
+    NEXT();
+}
+c_intrinsic:
+    MARK();
+t_intrinsic : {
+    int ip = t - code;
+    interpet_intrinsic(stack, &sp, &ip, T_IN, &T_OP, prog);
+    t = code + ip;
+    DISPATCH();
+}
+c_dump:
+t_dump:
+    dump_stack(prog->out, stack, sp);
+    NEXT();
+c_bdump:
+t_bdump:
+    dump_back_stack(prog->out, backStack, sp);
+    NEXT();
+c_dup:
+    NEED(1);
+    MARK();
+t_dup:
+    stack[sp] = stack[sp - 1];
+    sp++;
+    NEXT();
+c_2dup:
+    NEED(2);
+    MARK();
+t_2dup:
+    stack[sp] = stack[sp - 2];
+    stack[sp + 1] = stack[sp - 1];
+    sp += 2;
+    NEXT();
+c_drop:
+    NEED(1);
+t_drop:
+    sp--;
+    NEXT();
+c_swap:
+    NEED(2);
+t_swap : {
+    long top = stack[sp - 1];
+    stack[sp - 1] = stack[sp - 2];
+    stack[sp - 2] = top;
+    NEXT();
+}
+c_stash:
+    interpet_stash(stack, &sp, backStack, &bsp, &T_OP);
+    NEXT();
+t_stash:
+    stash_unchecked(stack, &sp, backStack, &bsp);
+    NEXT();
+c_pop:
+    interpet_pop(stack, &sp, backStack, &bsp, &T_OP);
+    NEXT();
+t_pop:
+    pop_unchecked(stack, &sp, backStack, &bsp);
+    NEXT();
+c_libc:
+    MARK();
+    interpet_libc_call(stack, &sp, T_IN, &T_OP, prog);
+    NEXT();
+t_libc:
+    libc_call_unchecked(stack, &sp, T_IN, prog);
+    NEXT();
+c_load:
+    MARK();
+t_load : {
+    long at = 0;
+    memcpy(&at, prog->vm.mem + t->op, T_IN.sub);
+    stack[sp++] = at;
+    NEXT();
+}
+c_store:
+    NEED(1);
+t_store : {
+    long val = stack[--sp];
+    memcpy(prog->vm.mem + t->op, &val, sizeof(long));
+    NEXT();
+}
+c_putd_char:
+    NEED(1);
+t_putd_char:
+    fprintf(prog->out, "%ld%c", stack[--sp], (int)t->op);
+    NEXT();
+
+#undef BINOP
+#undef MARK
+#undef NEED
+#undef NEXT
+#undef DISPATCH
+#undef T_IN
+#undef T_OP
+
+c_halt:
+t_halt:
+    guard_leave();
+    free(code);
+    check_unhandled_data(prog->out, stack, sp);
+
+    stack_unmap(stack, stack_size, 0);
+    stack_unmap(backStack, backstack_slots(), 0);
+    return true;
+}
+
+// Threaded engine caching the top two values in locals, `t0` the top and
+// `t1` the one below, so most ops touch the stack array once or not at all.
+// The cache is always full: the array holds everything below `t1`, with two
+// spare cells under it to spill into while the stack has fewer than two
+// values. Ops without a handler spill the cache, run on the plain layout and
+// fill it again. Only verified programs run here, there are no checks.
+bool interpet_tos(ProgramRun *prog) {
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
+    static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
+    static_assert(BT_COUNT == 8, "Implement newly added BinopType");
+
+    if (!prog->verified)
+        return interpet_switch(prog);
+
+    void *ops[OP_COUNT] = {
+        [OP_NOP] = &&halt,
+        [OP_LIT_NUMBER] = &&lit,
+        [OP_LIT_STR] = &&lit,
+        [OP_DUMP] = &&spilled,
+        [OP_BDUMP] = &&spilled,
+        [OP_DUP] = &&dup,
+        [OP_2DUP] = &&dup2,
+        [OP_DROP] = &&drop,
+        [OP_SWAP] = &&swap,
+        [OP_STASH] = &&stash,
+        [OP_POP] = &&pop,
+        [OP_LIBC] = &&spilled,
+        [OP_LOAD] = &&load,
+        [OP_STORE] = &&store,
+        [OP_PUTD_CHAR] = &&putd_char,
+    };
+    void *binops[BT_COUNT] = {
+        [BT_PLUS] = &&plus,
+        [BT_MINUS] = &&minus,
+        [BT_MULT] = &&mult,
+        [BT_DIV] = &&div,
+        [BT_MOD] = &&mod,
+        [BT_LT] = &&lt,
+        [BT_GT] = &&gt,
+        [BT_EQ] = &&eq,
+    };
+    void *binops_imm[BT_COUNT] = {
+        [BT_PLUS] = &&plus_imm,
+        [BT_MINUS] = &&minus_imm,
+        [BT_MULT] = &&mult_imm,
+        [BT_DIV] = &&div_imm,
+        [BT_MOD] = &&mod_imm,
+        [BT_LT] = &&lt_imm,
+        [BT_GT] = &&gt_imm,
+        [BT_EQ] = &&eq_imm,
+    };
+    void *cmp_dos[BT_COUNT] = {
+        [BT_PLUS] = &&plus_do,
+        [BT_MINUS] = &&minus_do,
+        [BT_MULT] = &&mult_do,
+        [BT_DIV] = &&div_do,
+        [BT_MOD] = &&mod_do,
+        [BT_LT] = &&lt_do,
+        [BT_GT] = &&gt_do,
+        [BT_EQ] = &&eq_do,
+    };
+    void *intrinsics[W_COUNT] = {
+        [W_DEFINED] = &&spilled,
+        [W_PUTD] = &&putd,
+        [W_LOOP] = &&next,
+        [W_END] = &&jump,
+        [W_MEM] = &&spilled,
+        [W_W_MEM] = &&spilled,
+        [W_W_MEM64] = &&w_mem64,
+        [W_DEREF] = &&deref,
+        [W_DO] = &&branch,
+        [W_PUTC] = &&putc,
+        [W_PRINTLN] = &&println,
+        [W_PRINT] = &&print,
+        [W_IF] = &&branch,
+        [W_ELSE] = &&jump,
+        [W_ENDIF] = &&next,
+        [W_AS_STR] = &&spilled,
+        [W_DEF] = &&spilled,
+        [W_INCLUDE] = &&spilled,
+    };
+
+    long *stack = stack_map(stack_size, 2);
+    long *backStack = stack_map(backstack_slots(), 0);
+    int bsp = 0;
+
+    Thread *code = malloc(sizeof(Thread) * prog->vm.prog.cnt);
+    FOR_LIST(prog->vm.prog) {
+        Inst o = prog->vm.code[i];
+        void *h = ops[o.t];
+        if (o.t == OP_BINOP)
+            h = binops[o.op];
+        else if (o.t == OP_INTRINSIC)
+            h = intrinsics[o.op];
+        else if (o.t == OP_BINOP_IMM)
+            h = binops_imm[o.sub];
+        else if (o.t == OP_CMP_DO)
+            h = cmp_dos[o.sub];
+        code[i] = (Thread){h, o.op, code + o.link};
+    }
+
+    // Everything below t1 is at stack[0 .. p - stack).
+    long *p = stack - 2;
+    long t0 = 0, t1 = 0;
+    int sp = 0;
+
+#define T_OP VEC_GET(prog->vm.prog, t - code)
+#define T_IN prog->vm.code[t - code]
+#define DISPATCH() goto *t->h
+#define NEXT()      \
+    do {            \
+        t++;        \
+        DISPATCH(); \
+    } while (0)
+#define PUSH(v)       \
+    do {              \
+        *p++ = t1;    \
+        t1 = t0;      \
+        t0 = (v);     \
+    } while (0)
+#define DROP()        \
+    do {              \
+        t0 = t1;      \
+        t1 = *--p;    \
+    } while (0)
+// Plain layout in stack[0 .. sp) and back.
+#define SPILL()                      \
+    do {                             \
+        p[0] = t1;                   \
+        p[1] = t0;                   \
+        sp = p - stack + 2;          \
+    } while (0)
+#define FILL()                       \
+    do {                             \
+        p = stack + sp - 2;          \
+        t1 = p[0];                   \
+        t0 = p[1];                   \
+    } while (0)
+#define BINOP(name, expr)                    \
+    name : {                                 \
+        int top = t0;                        \
+        int ut = t1;                         \
+        t0 = (expr);                         \
+        t1 = *--p;                           \
+        NEXT();                              \
+    }                                        \
+    name##_imm : {                           \
+        int top = t->op;                     \
+        int ut = t0;                         \
+        t0 = (expr);                         \
+        NEXT();                              \
+    }                                        \
+    name##_do : {                            \
+        int top = t->op;                     \
+        int ut = t0;                         \
+        t = (expr) != 0 ? t + 1 : t->target; \
+        DISPATCH();                          \
+    }
+
+    Thread *t = code;
+    DISPATCH();
+
+    BINOP(plus, WRAP(top, +, ut));
+    BINOP(minus, WRAP(top, -, ut));
+    BINOP(mult, WRAP(top, *, ut));
+    BINOP(div, top / ut);
+    BINOP(mod, top % ut);
+    BINOP(lt, top < ut);
+    BINOP(gt, top > ut);
+    BINOP(eq, top == ut);
+
+lit:
+    PUSH(t->op);
+    NEXT();
+next:
+    NEXT();
+jump:
+    t = t->target;
+    DISPATCH();
+branch : {
+    long cond = t0;
+    DROP();
+    t = cond ? t + 1 : t->target;
+    DISPATCH();
+}
+putd:
+    fprintf(prog->out, "%ld", t0);
+    DROP();
+    NEXT();
+putc:
+    fprintf(prog->out, "%c", (int)t0);
+    DROP();
+    NEXT();
+println:
+    fprintf(prog->out, "%s\n", prog->vm.mem + t0);
+    DROP();
+    NEXT();
+print:
+    fprintf(prog->out, "%s", prog->vm.mem + t0);
+    DROP();
+    NEXT();
+w_mem64:
+    memcpy(prog->vm.mem + t0, &t1, sizeof(long));
+    t0 = p[-1];
+    t1 = p[-2];
+    p -= 2;
+    NEXT();
+deref : {
+    long at = 0;
+    memcpy(&at, prog->vm.mem + t0, t1);
+    t0 = at;
+    t1 = *--p;
+    NEXT();
+}
+dup:
+    *p++ = t1;
+    t1 = t0;
+    NEXT();
+dup2:
+    *p++ = t1;
+    *p++ = t0;
+    NEXT();
+drop:
+    DROP();
+    NEXT();
+swap : {
+    long top = t0;
+    t0 = t1;
+    t1 = top;
+    NEXT();
+}
+stash : {
+    long n = t0;
+    DROP();
+    for (long i = 0; i < n; i++) {
+        backStack[bsp++] = t0;
+        DROP();
+    }
+    NEXT();
+}
+pop : {
+    long n = t0;
+    DROP();
+    for (long i = 0; i < n; i++)
+        PUSH(backStack[--bsp]);
+    NEXT();
+}
+load : {
+    long at = 0;
+    memcpy(&at, prog->vm.mem + t->op, T_IN.sub);
+    PUSH(at);
+    NEXT();
+}
+store:
+    memcpy(prog->vm.mem + t->op, &t0, sizeof(long));
+    DROP();
+    NEXT();
+putd_char:
+    fprintf(prog->out, "%ld%c", t0, (int)t->op);
+    DROP();
+    NEXT();
+spilled : {
+    SPILL();
+    int ip = t - code;
+    Inst in = T_IN;
+    switch (in.t) {
+    case OP_DUMP:
+        dump_stack(prog->out, stack, sp);
+        ip++;
+        break;
+    case OP_BDUMP:
+        dump_back_stack(prog->out, backStack, sp);
+        ip++;
+        break;
+    case OP_LIBC:
+        libc_call_unchecked(stack, &sp, in, prog);
+        ip++;
+        break;
+    default:
+        interpet_intrinsic(stack, &sp, &ip, in, &T_OP, prog);
+        break;
+    }
+    FILL();
+    t = code + ip;
+    DISPATCH();
+}
+halt:
+    SPILL();
+    free(code);
+    check_unhandled_data(prog->out, stack, sp);
+
+    stack_unmap(stack, stack_size, 2);
+    stack_unmap(backStack, backstack_slots(), 0);
+    return true;
+
+#undef BINOP
+#undef FILL
+#undef SPILL
+#undef DROP
+#undef PUSH
+#undef NEXT
+#undef DISPATCH
+#undef T_IN
+#undef T_OP
+}
+
+// :jit
+// Template JIT for `--jit`: every op is copied as a short machine code
+// template into an executable mapping, with operands and link targets patched
+// in. Ops without a template call jit_step, running them through the checked
+// interpreter, so templates can be added one at a time. Only x86-64 has
+// templates, elsewhere the whole program falls back to interpet_switch.
+// Register use inside the code:
+//   r12 data stack pointer, rbx data stack base, r15 data stack slot that
+//   overflows, r14 vm.mem, rbp the JitCtx.
+typedef struct {
+    ProgramRun *prog;
+    long *stack;
+    long *limit; // &stack[stack_size - 1]
+    char *mem;
+    int sp; // synced around every call out of the code
+    long *backStack;
+    int bsp;
+} JitCtx;
+
+// Called from the code for ops without a template.
+void jit_step(JitCtx *ctx, int ip) {
+    step_op(ctx->prog, ip, ctx->stack, &ctx->sp, ctx->backStack, &ctx->bsp);
+}
+
+typedef enum {
+    JIT_UNDERFLOW,
+    JIT_OVERFLOW,
+} JitFail;
+
+// Cold stubs land here with the failing op, `val` is the amount an underflow
+// needed.
+void jit_fail(JitCtx *ctx, int ip, JitFail kind, long val) {
+    Op o = VEC_GET(ctx->prog->vm.prog, ip);
+    if (kind == JIT_UNDERFLOW)
+        can_pop_amount(ctx->sp, val, o);
+    overflow_error(o);
+}
+
+#if defined(__x86_64__)
+enum {
+    RAX = 0,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R12 = 12,
+    R13,
+    R14,
+    R15,
+};
+
+typedef struct {
+    int at; // offset of the rel32
+    int ip; // target op, or stub index when `stub`
+    bool stub;
+} JitFixup;
+List(JitFixups, JitFixup);
+
+typedef struct {
+    int ip;
+    JitFail kind;
+    long val; // amount needed for underflow
+} JitStub;
+List(JitStubs, JitStub);
+
+typedef struct {
+    ByteList code;
+    JitFixups fixups;
+    JitStubs stubs;
+    bool checked;
+} Jit;
+
+void jit_bytes(Jit *j, const char *bytes, int n) {
+    for (int i = 0; i < n; i++)
+        VEC_ADD(&j->code, bytes[i]);
+}
+
+#define JIT(j, ...)                                         \
+    do {                                                    \
+        const char bytes_[] = {__VA_ARGS__};                \
+        jit_bytes(j, bytes_, (int)sizeof(bytes_));          \
+    } while (0)
+
+void jit_u32(Jit *j, uint32_t v) {
+    jit_bytes(j, (char *)&v, 4);
+}
+
+void jit_u64(Jit *j, uint64_t v) {
+    jit_bytes(j, (char *)&v, 8);
+}
+
+// REX.W? opcode with `reg` and a [base + disp32] operand.
+void jit_mem(Jit *j, bool wide, const char *op, int n, int reg, int base, int32_t disp) {
+    char rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+    if (rex != 0x40)
+        JIT(j, rex);
+    jit_bytes(j, op, n);
+    JIT(j, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+        JIT(j, 0x24);
+    jit_u32(j, disp);
+}
+
+// mov reg, qword [base + disp]
+void jit_load(Jit *j, int reg, int base, int32_t disp) {
+    jit_mem(j, true, "\x8b", 1, reg, base, disp);
+}
+
+// mov qword [base + disp], reg
+void jit_store(Jit *j, int reg, int base, int32_t disp) {
+    jit_mem(j, true, "\x89", 1, reg, base, disp);
+}
+
+// mov reg32, dword [base + disp]
+void jit_load32(Jit *j, int reg, int base, int32_t disp) {
+    jit_mem(j, false, "\x8b", 1, reg, base, disp);
+}
+
+// add r12, imm32
+void jit_move_sp(Jit *j, int slots) {
+    if (slots == 0)
+        return;
+    JIT(j, 0x49, 0x81, 0xc4);
+    jit_u32(j, 8 * slots);
+}
+
+void jit_jump_to(Jit *j, int ip, bool stub) {
+    JitFixup f = {j->code.cnt, ip, stub};
+    VEC_ADD(&j->fixups, f);
+    jit_u32(j, 0);
+}
+
+// jcc rel32, `cc` is the low nibble of the 0f 8x opcode.
+void jit_jcc(Jit *j, int cc, int ip) {
+    JIT(j, 0x0f, 0x80 | cc);
+    jit_jump_to(j, ip, false);
+}
+
+void jit_jmp(Jit *j, int ip) {
+    JIT(j, 0xe9);
+    jit_jump_to(j, ip, false);
+}
+
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xc
+#define CC_GE 0xd
+#define CC_LE 0xe
+#define CC_G 0xf
+
+void jit_stub_jump(Jit *j, int cc, int ip, JitFail kind, long val) {
+    JitStub stub = {ip, kind, val};
+    VEC_ADD(&j->stubs, stub);
+    JIT(j, 0x0f, 0x80 | cc);
+    jit_jump_to(j, j->stubs.cnt - 1, true);
+}
+
+void jit_need(Jit *j, int ip, int amount) {
+    if (!j->checked)
+        return;
+    // lea rax, [r12 - 8 * amount]; cmp rax, rbx; jb stub
+    jit_mem(j, true, "\x8d", 1, RAX, R12, -8 * amount);
+    JIT(j, 0x48, 0x39, 0xd8);
+    jit_stub_jump(j, CC_B, ip, JIT_UNDERFLOW, amount);
+}
+
+void jit_room(Jit *j, int ip, int slot) {
+    if (!j->checked)
+        return;
+    // lea rax, [r12 + 8 * slot]; cmp rax, r15; jae stub
+    jit_mem(j, true, "\x8d", 1, RAX, R12, 8 * slot);
+    JIT(j, 0x4c, 0x39, 0xf8);
+    jit_stub_jump(j, CC_AE, ip, JIT_OVERFLOW, 0);
+}
+
+// mov rax, imm64; call rax
+void jit_call(Jit *j, void *fn) {
+    JIT(j, 0x48, 0xb8);
+    jit_u64(j, (uint64_t)(uintptr_t)fn);
+    JIT(j, 0xff, 0xd0);
+}
+
+// eax = top, ecx = ut, leaves `top op ut` in rax like binop_eval.
+void jit_binop_eval(Jit *j, BinopType type) {
+    static_assert(BT_COUNT == 8, "Implement newly added BinopType");
+    switch (type) {
+    case BT_PLUS:
+        JIT(j, 0x01, 0xc8);
+        break;
+    case BT_MINUS:
+        JIT(j, 0x29, 0xc8);
+        break;
+    case BT_MULT:
+        JIT(j, 0x0f, 0xaf, 0xc1);
+        break;
+    case BT_DIV:
+        JIT(j, 0x99, 0xf7, 0xf9);
+        break;
+    case BT_MOD:
+        JIT(j, 0x99, 0xf7, 0xf9, 0x89, 0xd0);
+        break;
+    case BT_LT:
+    case BT_GT:
+    case BT_EQ: {
+        char set = type == BT_LT ? 0x9c : type == BT_GT ? 0x9f : 0x94;
+        // cmp eax, ecx; setcc al; movzx eax, al
+        JIT(j, 0x39, 0xc8, 0x0f, set, 0xc0, 0x0f, 0xb6, 0xc0);
+        return;
+    }
+    default:
+        assert(false && "unreachable");
+    }
+    JIT(j, 0x48, 0x98); // cdqe
+}
+
+// Calls jit_step for the op, syncing the stack pointer around it.
+void jit_fallback(Jit *j, int ip) {
+    // mov rax, r12; sub rax, rbx; sar rax, 3; mov [rbp + sp], eax
+    JIT(j, 0x4c, 0x89, 0xe0, 0x48, 0x29, 0xd8, 0x48, 0xc1, 0xf8, 0x03);
+    jit_mem(j, false, "\x89", 1, RAX, RBP, offsetof(JitCtx, sp));
+    // mov rdi, rbp; mov esi, ip
+    JIT(j, 0x48, 0x89, 0xef, 0xbe);
+    jit_u32(j, ip);
+    jit_call(j, (void *)jit_step);
+    // movsxd rax, [rbp + sp]; lea r12, [rbx + rax * 8]
+    jit_mem(j, true, "\x63", 1, RAX, RBP, offsetof(JitCtx, sp));
+    JIT(j, 0x4c, 0x8d, 0x24, 0xc3);
+}
+
+// Returns false for ops without a template.
+bool jit_op(Jit *j, Op o, int ip) {
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
+    switch (o.t) {
+    case OP_BINOP:
+        jit_need(j, ip, 2);
+        jit_load32(j, RAX, R12, -8);
+        jit_load32(j, RCX, R12, -16);
+        jit_binop_eval(j, o.op);
+        jit_store(j, RAX, R12, -16);
+        jit_move_sp(j, -1);
+        return true;
+    case OP_LIT_NUMBER:
+    case OP_LIT_STR:
+        // mov rcx, imm64
+        JIT(j, 0x48, 0xb9);
+        jit_u64(j, o.op);
+        jit_room(j, ip, 0);
+        jit_store(j, RCX, R12, 0);
+        jit_move_sp(j, 1);
+        return true;
+    case OP_DUP:
+        jit_need(j, ip, 1);
+        jit_load(j, RCX, R12, -8);
+        jit_room(j, ip, 0);
+        jit_store(j, RCX, R12, 0);
+        jit_move_sp(j, 1);
+        return true;
+    case OP_2DUP:
+        jit_need(j, ip, 2);
+        jit_load(j, RCX, R12, -16);
+        jit_room(j, ip, 0);
+        jit_load(j, RCX, R12, -8);
+        jit_room(j, ip, 1);
+        jit_load(j, RDX, R12, -16);
+        jit_store(j, RDX, R12, 0);
+        jit_store(j, RCX, R12, 8);
+        jit_move_sp(j, 2);
+        return true;
+    case OP_DROP:
+        jit_need(j, ip, 1);
+        jit_move_sp(j, -1);
+        return true;
+    case OP_SWAP:
+        jit_need(j, ip, 2);
+        jit_load(j, RAX, R12, -8);
+        jit_load(j, RCX, R12, -16);
+        jit_store(j, RCX, R12, -8);
+        jit_store(j, RAX, R12, -16);
+        return true;
+    case OP_INTRINSIC:
+        switch (o.op) {
+        case W_LOOP:
+        case W_ENDIF:
+            return true;
+        case W_END:
+        case W_ELSE:
+            jit_jmp(j, o.link);
+            return true;
+        case W_DO:
+        case W_IF:
+            jit_need(j, ip, 1);
+            jit_move_sp(j, -1);
+            // cmp qword [r12], 0
+            jit_mem(j, true, "\x83", 1, 7, R12, 0);
+            JIT(j, 0x00);
+            jit_jcc(j, CC_E, o.link);
+            return true;
+        case W_W_MEM64:
+            jit_need(j, ip, 2);
+            jit_load(j, RAX, R12, -8);
+            jit_load(j, RCX, R12, -16);
+            // mov [r14 + rax], rcx
+            JIT(j, 0x49, 0x89, 0x0c, 0x06);
+            jit_move_sp(j, -2);
+            return true;
+        default:
+            return false;
+        }
+    case OP_LOAD:
+        switch (o.sub) {
+        case 1:
+            jit_mem(j, false, "\x0f\xb6", 2, RCX, R14, o.op);
+            break;
+        case 2:
+            jit_mem(j, false, "\x0f\xb7", 2, RCX, R14, o.op);
+            break;
+        case 4:
+            jit_load32(j, RCX, R14, o.op);
+            break;
+        case 8:
+            jit_load(j, RCX, R14, o.op);
+            break;
+        default:
+            return false;
+        }
+        jit_room(j, ip, 0);
+        jit_store(j, RCX, R12, 0);
+        jit_move_sp(j, 1);
+        return true;
+    case OP_STORE:
+        jit_need(j, ip, 1);
+        jit_load(j, RAX, R12, -8);
+        jit_store(j, RAX, R14, o.op);
+        jit_move_sp(j, -1);
+        return true;
+    case OP_BINOP_IMM:
+        jit_need(j, ip, 1);
+        JIT(j, 0xb8); // mov eax, imm32
+        jit_u32(j, (int)o.op);
+        jit_load32(j, RCX, R12, -8);
+        jit_binop_eval(j, o.sub);
+        jit_store(j, RAX, R12, -8);
+        return true;
+    case OP_CMP_DO: {
+        jit_need(j, ip, 1);
+        int exit_cc[BT_COUNT] = {[BT_LT] = CC_LE, [BT_GT] = CC_GE, [BT_EQ] = CC_NE};
+        if (exit_cc[o.sub] != 0) {
+            // cmp dword [r12 - 8], imm32
+            jit_mem(j, false, "\x81", 1, 7, R12, -8);
+            jit_u32(j, (int)o.op);
+            jit_jcc(j, exit_cc[o.sub], o.link);
+            return true;
+        }
+        JIT(j, 0xb8);
+        jit_u32(j, (int)o.op);
+        jit_load32(j, RCX, R12, -8);
+        jit_binop_eval(j, o.sub);
+        JIT(j, 0x85, 0xc0); // test eax, eax
+        jit_jcc(j, CC_E, o.link);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+typedef void (*JitEntry)(JitCtx *ctx);
+
+// Returns NULL when the code can't be mapped.
+JitEntry jit_compile(ProgramRun *prog, size_t *size, int *fallbacks) {
+    Program p = prog->vm.prog;
+    Jit j = {.checked = !prog->verified};
+    int *at = malloc(sizeof(int) * (p.cnt + 1));
+
+    // push rbp, rbx, r12..r15; sub rsp, 8; mov rbp, rdi
+    JIT(&j, 0x55, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+    JIT(&j, 0x48, 0x83, 0xec, 0x08, 0x48, 0x89, 0xfd);
+    jit_load(&j, RBX, RBP, offsetof(JitCtx, stack));
+    jit_load(&j, R15, RBP, offsetof(JitCtx, limit));
+    jit_load(&j, R14, RBP, offsetof(JitCtx, mem));
+    JIT(&j, 0x49, 0x89, 0xdc); // mov r12, rbx
+
+    *fallbacks = 0;
+    int end = p.cnt;
+    for (int ip = 0; ip < p.cnt; ip++) {
+        Op o = VEC_GET(p, ip);
+        at[ip] = j.code.cnt;
+        if (o.t == OP_NOP) {
+            end = ip;
+            break;
+        }
+        int mark = j.code.cnt, fixups = j.fixups.cnt, stubs = j.stubs.cnt;
+        if (!jit_op(&j, o, ip)) {
+            j.code.cnt = mark;
+            j.fixups.cnt = fixups;
+            j.stubs.cnt = stubs;
+            jit_fallback(&j, ip);
+            *fallbacks += 1;
+        }
+    }
+    at[end] = j.code.cnt;
+
+    // mov rax, r12; sub rax, rbx; sar rax, 3; mov [rbp + sp], eax
+    JIT(&j, 0x4c, 0x89, 0xe0, 0x48, 0x29, 0xd8, 0x48, 0xc1, 0xf8, 0x03);
+    jit_mem(&j, false, "\x89", 1, RAX, RBP, offsetof(JitCtx, sp));
+    // add rsp, 8; pop r15..r12, rbx, rbp; ret
+    JIT(&j, 0x48, 0x83, 0xc4, 0x08);
+    JIT(&j, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0x5d, 0xc3);
+
+    int *stub_at = malloc(sizeof(int) * (j.stubs.cnt + 1));
+    FOR_LIST(j.stubs) {
+        JitStub stub = VEC_GET(j.stubs, i);
+        stub_at[i] = j.code.cnt;
+        // Sync sp.
+        JIT(&j, 0x4c, 0x89, 0xe0, 0x48, 0x29, 0xd8, 0x48, 0xc1, 0xf8, 0x03);
+        jit_mem(&j, false, "\x89", 1, RAX, RBP, offsetof(JitCtx, sp));
+        if (stub.kind == JIT_UNDERFLOW) {
+            JIT(&j, 0x48, 0xb9); // mov rcx, imm64
+            jit_u64(&j, stub.val);
+        }
+        // mov rdi, rbp; mov esi, ip; mov edx, kind
+        JIT(&j, 0x48, 0x89, 0xef, 0xbe);
+        jit_u32(&j, stub.ip);
+        JIT(&j, 0xba);
+        jit_u32(&j, stub.kind);
+        jit_call(&j, (void *)jit_fail);
+    }
+
+    FOR_LIST(j.fixups) {
+        JitFixup f = VEC_GET(j.fixups, i);
+        int32_t rel = (f.stub ? stub_at[f.ip] : at[f.ip]) - (f.at + 4);
+        memcpy(j.code.data + f.at, &rel, 4);
+    }
+
+    *size = j.code.cnt;
+    void *code = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED) {
+        memcpy(code, j.code.data, *size);
+        if (mprotect(code, *size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, *size);
+            code = MAP_FAILED;
+        }
+    }
+
+    free(at);
+    free(stub_at);
+    VEC_FREE(j.code);
+    VEC_FREE(j.fixups);
+    VEC_FREE(j.stubs);
+    return code == MAP_FAILED ? NULL : (JitEntry)code;
+}
+#endif
+
+bool interpet_jit(ProgramRun *prog) {
+#if defined(__x86_64__)
+    size_t size;
+    int fallbacks;
+    JitEntry entry = jit_compile(prog, &size, &fallbacks);
+    if (entry != NULL) {
+        prog->stats.jit_size = size;
+        prog->stats.jit_fallbacks = fallbacks;
+        track_map((void *)entry, size);
+        JitCtx ctx = {.prog = prog, .mem = prog->vm.mem};
+        ctx.stack = stack_map(stack_size, 0);
+        ctx.limit = &ctx.stack[stack_size - 1];
+        ctx.backStack = stack_map(backstack_slots(), 0);
+        guard_enter(prog, ctx.stack);
+        entry(&ctx);
+        guard_leave();
+        check_unhandled_data(prog->out, ctx.stack, ctx.sp);
+        stack_unmap(ctx.stack, stack_size, 0);
+        stack_unmap(ctx.backStack, backstack_slots(), 0);
+        untrack_map((void *)entry);
+        munmap((void *)entry, size);
+        return true;
+    }
+#endif
+    return interpet_switch(prog);
+}
+
+// Compiles without running, for --stats which runs on the counting loop.
+void measure_jit(ProgramRun *prog) {
+#if defined(__x86_64__)
+    size_t size;
+    int fallbacks;
+    JitEntry entry = jit_compile(prog, &size, &fallbacks);
+    if (entry == NULL)
+        return;
+    prog->stats.jit_size = size;
+    prog->stats.jit_fallbacks = fallbacks;
+    munmap((void *)entry, size);
+#endif
+}
+// ;jit
+
+// `auto` runs verified programs on the top of stack caching engine and keeps
+// the checked switch loop for anything verify_stack couldn't prove.
+bool interpet(ProgramRun *prog) {
+    switch (prog->opts.engine) {
+    case ENGINE_JIT:
+        return interpet_jit(prog);
+    case ENGINE_TOS:
+        return interpet_tos(prog);
+    case ENGINE_THREADED:
+        return interpet_threaded(prog);
+    case ENGINE_SWITCH:
+        return interpet_switch(prog);
+    default:
+        return interpet_tos(prog);
+    }
+}
+
+// ;interpet
+
+// :verifier
+// Static stack effect check over the linked program. Every reachable path is
+// walked tracking the exact depth of both stacks. Underflow or overflow that
+// every run reaches is reported before anything runs. One only some paths
+// reach, or paths that meet with different depths, leave the program
+// unproven, it runs on the checked engines.
+typedef struct {
+    int depth;
+    int bdepth;
+} StackState;
+
+#define UNREACHED -1
+
+void verify_room(StackState s, int amount, Op o) {
+    if (s.depth + amount < stack_size)
+        return;
+    if (o.t == OP_LIT_NUMBER || o.t == OP_LIT_STR)
+        error(ERR_OVERFLOW, o, "Can't push literal number %d\n", o.op);
+    error(ERR_OVERFLOW, o, "`%s` can't push %d more value(s).\n", op_to_syntax(o), amount);
+}
+
+// Count taken by `<-` and `->`, only known when it is a literal that can't
+// be jumped over.
+long verify_count(Program p, bool *is_target, int ip) {
+    if (ip == 0 || is_target[ip])
+        return -1;
+    Op prev = VEC_GET(p, ip - 1);
+    return prev.t == OP_LIT_NUMBER ? prev.op : -1;
+}
+
+// Returns false when `to` is reached with two different depths, a loop that
+// grows or shrinks the stack or branches that disagree. Whether that stays in
+// bounds depends on how often it runs, so it is left to the checked engines.
+bool verify_edge(StackState *states, IntList *work, int to, StackState s) {
+    StackState old = states[to];
+    if (old.depth == UNREACHED) {
+        states[to] = s;
+        VEC_ADD(work, to);
+        return true;
+    }
+    return old.depth == s.depth && old.bdepth == s.bdepth;
+}
+
+// Whether every run of the program goes through block `b`: without it the
+// entry reaches neither an end nor a loop, so each path stops before `b`.
+bool block_is_certain(const Cfg *cfg, int b) {
+    if (b == 0)
+        return true;
+    // 0 unseen, 1 on the DFS stack, 2 done.
+    char *color = calloc(cfg->blocks.cnt, 1);
+    IntList stack = {0}, next = {0};
+    bool certain = true;
+    VEC_ADD(&stack, 0);
+    VEC_ADD(&next, 0);
+    color[0] = 1;
+    while (stack.cnt > 0 && certain) {
+        Block blk = VEC_GET(cfg->blocks, VEC_GET(stack, stack.cnt - 1));
+        int *i = &VEC_GET(next, next.cnt - 1);
+        if (blk.succ.cnt == 0)
+            certain = false;
+        if (*i == blk.succ.cnt || !certain) {
+            color[VEC_GET(stack, stack.cnt - 1)] = 2;
+            stack.cnt--;
+            next.cnt--;
+            continue;
+        }
+        int to = VEC_GET(blk.succ, (*i)++);
+        if (to == b || color[to] == 2)
+            continue;
+        if (color[to] == 1) {
+            certain = false;
+            continue;
+        }
+        color[to] = 1;
+        VEC_ADD(&stack, to);
+        VEC_ADD(&next, 0);
+    }
+    free(color);
+    VEC_FREE(stack);
+    VEC_FREE(next);
+    return certain;
+}
+
+// One walk over the reachable blocks filling `states`. Returns false when a
+// count is only known at run time or two paths meet with different depths.
+// A path ends at its first failed check, which sets `failed`, and `certain`
+// when every run gets there. Depths are only exact once the whole walk
+// agreed, so errors are reported by a second walk with `report` set.
+static bool verify_pass(ProgramRun *prog, StackState *states, bool report, bool *failed, bool *certain) {
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
+    static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
+
+#define VERIFY(ok, report_it)                                     \
+    do {                                                          \
+        if (!(ok) && !dead) {                                     \
+            dead = true;                                          \
+            *failed = true;                                       \
+            if (block_is_certain(cfg, cfg->block_of[ip])) {       \
+                *certain = true;                                  \
+                if (report)                                       \
+                    report_it;                                    \
+            }                                                     \
+        }                                                         \
+    } while (0)
+#define VERIFY_POP(n) VERIFY(s.depth - (n) >= 0, can_pop_amount(s.depth, (n), o))
+#define VERIFY_ROOM(n) VERIFY(s.depth + (n) < stack_size, verify_room(s, (n), o))
+
+    Program p = prog->vm.prog;
+    const Cfg *cfg = &prog->cfg;
+    FOR_LIST(p) {
+        states[i] = (StackState){UNREACHED, UNREACHED};
+    }
+
+    IntList work = {0};
+    states[0] = (StackState){0, 0};
+    VEC_ADD(&work, 0);
+
+    bool proven = true;
+    // Work items are block starts, the ops inside a block only fall through.
+    while (work.cnt > 0 && proven) {
+        Block blk = VEC_GET(cfg->blocks, cfg->block_of[VEC_GET(work, --work.cnt)]);
+        bool dead = false;
+        for (int ip = blk.start; ip < blk.end && proven && !dead; ip++) {
+            Op o = VEC_GET(p, ip);
+            StackState s = states[ip];
+
+            switch (o.t) {
+            case OP_NOP:
+                break;
+            case OP_BINOP:
+                VERIFY_POP(2);
+                s.depth -= 1;
+                break;
+            case OP_LIT_NUMBER:
+            case OP_LIT_STR:
+                VERIFY_ROOM(1);
+                s.depth += 1;
+                break;
+            case OP_INTRINSIC: {
+                switch (o.op) {
+                case W_PUTD:
+                case W_PUTC:
+                case W_PRINTLN:
+                case W_PRINT:
+                    VERIFY_POP(1);
+                    s.depth -= 1;
+                    break;
+                case W_DO:
+                case W_IF:
+                    VERIFY_POP(1);
+                    s.depth -= 1;
+                    break;
+                case W_END:
+                case W_ELSE:
+                case W_LOOP:
+                case W_ENDIF:
+                    break;
+                case W_W_MEM:
+                case W_W_MEM64:
+                    VERIFY_POP(2);
+                    s.depth -= 2;
+                    break;
+                case W_DEREF:
+                case W_AS_STR:
+                    VERIFY_POP(2);
+                    s.depth -= 1;
+                    break;
+                default:
+                    proven = false;
+                    break;
+                }
+            } break;
+            case OP_DUMP:
+            case OP_BDUMP:
+                break;
+            case OP_DUP:
+                VERIFY_POP(1);
+                VERIFY_ROOM(1);
+                s.depth += 1;
+                break;
+            case OP_2DUP:
+                VERIFY_POP(2);
+                VERIFY_ROOM(2);
+                s.depth += 2;
+                break;
+            case OP_DROP:
+                VERIFY_POP(1);
+                s.depth -= 1;
+                break;
+            case OP_SWAP:
+                VERIFY_POP(2);
+                break;
+            case OP_STASH: {
+                VERIFY_POP(1);
+                long n = verify_count(p, cfg->is_target, ip);
+                if (n < 0) {
+                    proven = false;
+                    break;
+                }
+                s.depth -= 1;
+                VERIFY(s.depth - n >= 0, error(ERR_UNDERFLOW, o, "Trying to stash %d values on the stack, but only %d are available.\n", n, s.depth));
+                VERIFY(s.bdepth + n < backstack_size, error(ERR_BACK_OVERFLOW, o, "Can't stash %d values on back stack.\n", n));
+                s.depth -= n;
+                s.bdepth += n;
+            } break;
+            case OP_POP: {
+                VERIFY_POP(1);
+                long n = verify_count(p, cfg->is_target, ip);
+                if (n < 0) {
+                    proven = false;
+                    break;
+                }
+                s.depth -= 1;
+                VERIFY(s.bdepth - n >= 0, error(ERR_UNDERFLOW, o, "Trying to pop %d values from the back stack, but only %d are available.\n", n, s.depth));
+                VERIFY(s.depth + n < stack_size, error(ERR_OVERFLOW, o, "Can't pop %d values on stack.\n", n));
+                s.depth += n;
+                s.bdepth -= n;
+            } break;
+            case OP_LOAD:
+                VERIFY_ROOM(1);
+                s.depth += 1;
+                break;
+            case OP_STORE:
+            case OP_PUTD_CHAR:
+                VERIFY_POP(1);
+                s.depth -= 1;
+                break;
+            case OP_BINOP_IMM:
+                VERIFY_POP(1);
+                break;
+            case OP_CMP_DO:
+                VERIFY_POP(1);
+                break;
+            case OP_LIBC: {
+                LibcFunc f = libc_funcs[o.op];
+                VERIFY_POP(f.arity);
+                s.depth -= f.arity;
+                if (f.returns)
+                    s.depth += 1;
+            } break;
+            default:
+                proven = false;
+                break;
+            }
+
+            if (!proven || dead)
+                break;
+            if (ip + 1 < blk.end) {
+                states[ip + 1] = s;
+                continue;
+            }
+            for (int i = 0; i < blk.succ.cnt && proven; i++)
+                proven = verify_edge(states, &work, VEC_GET(cfg->blocks, VEC_GET(blk.succ, i)).start, s);
+        }
+    }
+
+    VEC_FREE(work);
+    return proven;
+#undef VERIFY_ROOM
+#undef VERIFY_POP
+#undef VERIFY
+}
+
+// Returns true when every op is proven to stay in bounds, false when that
+// depends on the path taken or on values only known at run time. When `out`
+// is given and the program is proven it receives the depths before each op,
+// UNREACHED for dead ops.
+bool verify_stack_states(ProgramRun *prog, StackState **out) {
+    StackState *states = malloc(sizeof(StackState) * prog->vm.prog.cnt);
+    bool failed = false, certain = false;
+    bool proven = verify_pass(prog, states, false, &failed, &certain);
+    // Only now are the depths exact, an error every run reaches is reported.
+    if (proven && certain)
+        verify_pass(prog, states, true, &failed, &certain);
+    proven = proven && !failed;
+    if (out != NULL && proven)
+        *out = states;
+    else
+        free(states);
+    return proven;
+}
+
+bool verify_stack(ProgramRun *prog) {
+    return verify_stack_states(prog, NULL);
+}
+// ;verifier
+
+// :optimizer
+// Peephole pass run on the linked program. Patterns are plain table entries:
+// `match` looks at `len` ops and `rewrite` writes the (shorter) replacement.
+// Patterns never span a jump target and every `link` is remapped afterwards.
+// It only runs on programs proven by verify_stack, so dropping a `. ,` can't
+// hide a stack underflow.
+typedef struct {
+    const char *name;
+    int len;
+    bool (*match)(Op *ops);
+    int (*rewrite)(Op *ops, Op *out);
+} Peephole;
+
+bool is_lit(Op o) {
+    return o.t == OP_LIT_NUMBER;
+}
+
+// Same 32 bit arithmetic as interpet_binop.
+bool fold_binop(BinopType type, int top, int ut, long *res) {
+    static_assert(BT_COUNT == 8, "Implement newly added BinopType");
+    switch (type) {
+    case BT_PLUS:
+        *res = WRAP(top, +, ut);
+        return true;
+    case BT_MINUS:
+        *res = WRAP(top, -, ut);
+        return true;
+    case BT_MULT:
+        *res = WRAP(top, *, ut);
+        return true;
+    case BT_DIV:
+    case BT_MOD:
+        // Leave traps to run time.
+        if (ut == 0 || (top == INT_MIN && ut == -1))
+            return false;
+        *res = type == BT_DIV ? top / ut : top % ut;
+        return true;
+    case BT_LT:
+        *res = top < ut;
+        return true;
+    case BT_GT:
+        *res = top > ut;
+        return true;
+    case BT_EQ:
+        *res = top == ut;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// LIT LIT BINOP -> LIT
+bool match_fold(Op *ops) {
+    long res;
+    return is_lit(ops[0]) && is_lit(ops[1]) && ops[2].t == OP_BINOP && fold_binop(ops[2].op, ops[1].op, ops[0].op, &res);
+}
+
+int rewrite_fold(Op *ops, Op *out) {
+    out[0] = ops[0];
+    fold_binop(ops[2].op, ops[1].op, ops[0].op, &out[0].op);
+    return 1;
+}
+
+// . , -> nothing
+bool match_dup_drop(Op *ops) {
+    return ops[0].t == OP_DUP && ops[1].t == OP_DROP;
+}
+
+// LIT , -> nothing
+bool match_lit_drop(Op *ops) {
+    return (is_lit(ops[0]) || ops[0].t == OP_LIT_STR) && ops[1].t == OP_DROP;
+}
+
+// ; ; -> nothing
+bool match_swap_swap(Op *ops) {
+    return ops[0].t == OP_SWAP && ops[1].t == OP_SWAP;
+}
+
+// N <- N -> -> nothing
+bool match_stash_pop(Op *ops) {
+    return is_lit(ops[0]) && ops[1].t == OP_STASH && is_lit(ops[2]) && ops[3].t == OP_POP && ops[0].op == ops[2].op && ops[0].op >= 0;
+}
+
+int rewrite_nothing(Op *ops, Op *out) {
+    _ ops;
+    _ out;
+    return 0;
+}
+
+#define PEEPHOLE_MAX_LEN 4
+Peephole peepholes[PH_COUNT] = {
+    [PH_FOLD] = {"fold", 3, match_fold, rewrite_fold},
+    [PH_DUP_DROP] = {"dup-drop", 2, match_dup_drop, rewrite_nothing},
+    [PH_LIT_DROP] = {"lit-drop", 2, match_lit_drop, rewrite_nothing},
+    [PH_SWAP_SWAP] = {"swap-swap", 2, match_swap_swap, rewrite_nothing},
+    [PH_STASH_POP] = {"stash-pop", 4, match_stash_pop, rewrite_nothing},
+};
+
+// One pass over the program trying `patterns` in order at every op, returns
+// whether anything changed. `removed` counts the ops dropped per pattern.
+bool rewrite_pass(ProgramRun *prog, Peephole *patterns, int count, long *removed) {
+    Program old = prog->vm.prog;
+    Program out = {0};
+    int *remap = malloc(sizeof(int) * (old.cnt + 1));
+    bool *is_target = prog->cfg.is_target;
+    bool changed = false;
+
+    int i = 0;
+    while (i < old.cnt) {
+        int applied = -1;
+        for (int k = 0; k < count && applied == -1; k++) {
+            Peephole ph = patterns[k];
+            if (i + ph.len >= old.cnt)
+                continue;
+            bool spans_target = false;
+            for (int j = 1; j < ph.len; j++)
+                spans_target = spans_target || is_target[i + j];
+            if (!spans_target && ph.match(old.data + i))
+                applied = k;
+        }
+
+        if (applied == -1) {
+            remap[i] = out.cnt;
+            VEC_ADD(&out, VEC_GET(old, i));
+            i++;
+            continue;
+        }
+
+        Peephole ph = patterns[applied];
+        Op repl[PEEPHOLE_MAX_LEN];
+        int n = ph.rewrite(old.data + i, repl);
+        for (int j = 0; j < ph.len; j++)
+            remap[i + j] = out.cnt;
+        for (int j = 0; j < n; j++)
+            VEC_ADD(&out, repl[j]);
+        removed[applied] += ph.len - n;
+        i += ph.len;
+        changed = true;
+    }
+    remap[old.cnt] = out.cnt;
+
+    relink(&out, remap);
+    VEC_FREE(old);
+    prog->vm.prog = out;
+    if (changed) {
+        free_cfg(&prog->cfg);
+        prog->cfg = build_cfg(out);
+    }
+
+    free(remap);
+    return changed;
+}
+
+void optimize(ProgramRun *prog) {
+    if (!prog->verified || prog->opts.no_opt)
+        return;
+    while (rewrite_pass(prog, peepholes, PH_COUNT, prog->stats.peephole))
+        ;
+}
+
+// Superinstructions fuse frequent sequences into a single op to save
+// dispatches. Selection runs after the peephole pass and tries the candidates
+// by descending weight, the number of times each sequence executed over the
+// corpus (tests/ and examples/). Regenerate the weights with
+// `./main <file> --seq-profile` summed over the corpus.
+typedef struct {
+    Peephole p;
+    long weight;
+} SuperInstr;
+
+bool is_lit_binop(Op *ops) {
+    return is_lit(ops[0]) && ops[1].t == OP_BINOP;
+}
+
+// LIT(size) LIT(addr) deref
+bool match_load(Op *ops) {
+    return is_lit(ops[0]) && ops[0].op > 0 && ops[0].op <= (long)sizeof(long) && is_lit(ops[1]) && is_intrinsic(ops[2], W_DEREF);
+}
+
+int rewrite_load(Op *ops, Op *out) {
+    out[0] = (Op){.l = ops[2].l, .t = OP_LOAD, .sub = ops[0].op, .op = ops[1].op, .index = ops[2].index};
+    return 1;
+}
+
+// LIT(addr) w64_mem
+bool match_store(Op *ops) {
+    return is_lit(ops[0]) && is_intrinsic(ops[1], W_W_MEM64);
+}
+
+int rewrite_store(Op *ops, Op *out) {
+    out[0] = (Op){.l = ops[1].l, .t = OP_STORE, .op = ops[0].op, .index = ops[1].index};
+    return 1;
+}
+
+// LIT BINOP
+bool match_binop_imm(Op *ops) {
+    return is_lit_binop(ops);
+}
+
+int rewrite_binop_imm(Op *ops, Op *out) {
+    out[0] = (Op){.l = ops[1].l, .t = OP_BINOP_IMM, .sub = ops[1].op, .op = ops[0].op, .index = ops[1].index};
+    return 1;
+}
+
+// . LIT BINOP do
+bool match_cmp_do(Op *ops) {
+    return ops[0].t == OP_DUP && is_lit_binop(ops + 1) && is_intrinsic(ops[3], W_DO);
+}
+
+int rewrite_cmp_do(Op *ops, Op *out) {
+    out[0] = (Op){.l = ops[3].l, .t = OP_CMP_DO, .sub = ops[2].op, .op = ops[1].op, .link = ops[3].link, .index = ops[3].index};
+    return 1;
+}
+
+// sout LIT putc
+bool match_putd_char(Op *ops) {
+    return is_intrinsic(ops[0], W_PUTD) && is_lit(ops[1]) && is_intrinsic(ops[2], W_PUTC);
+}
+
+int rewrite_putd_char(Op *ops, Op *out) {
+    out[0] = (Op){.l = ops[0].l, .t = OP_PUTD_CHAR, .op = ops[1].op, .index = ops[0].index};
+    return 1;
+}
+
+SuperInstr superinstrs[SI_COUNT] = {
+    [SI_LOAD] = {{"load", 3, match_load, rewrite_load}, 112},
+    [SI_STORE] = {{"store", 2, match_store, rewrite_store}, 84},
+    [SI_BINOP_IMM] = {{"binop-imm", 2, match_binop_imm, rewrite_binop_imm}, 133},
+    [SI_CMP_DO] = {{"cmp-do", 4, match_cmp_do, rewrite_cmp_do}, 75},
+    [SI_PUTD_CHAR] = {{"putd-char", 3, match_putd_char, rewrite_putd_char}, 178},
+};
+
+void select_superinstructions(ProgramRun *prog) {
+    if (!prog->verified || prog->opts.no_opt || prog->opts.seq_profile)
+        return;
+
+    int order[SI_COUNT];
+    for (int i = 0; i < SI_COUNT; i++) {
+        int j = i;
+        while (j > 0 && superinstrs[order[j - 1]].weight < superinstrs[i].weight) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    Peephole patterns[SI_COUNT];
+    long removed[SI_COUNT] = {0};
+    for (int i = 0; i < SI_COUNT; i++)
+        patterns[i] = superinstrs[order[i]].p;
+    rewrite_pass(prog, patterns, SI_COUNT, removed);
+    for (int i = 0; i < SI_COUNT; i++)
+        prog->stats.superinstr[order[i]] += removed[i];
+}
+
+// :seqprofile
+// Dynamic counts behind the superinstruction weights: how often each
+// candidate sequence starts at an executed op, plus the most executed pairs
+// of op kinds to spot new candidates.
+#define OP_KEY_COUNT (OP_COUNT + BT_COUNT + W_COUNT)
+
+struct SeqProfile {
+    long candidates[SI_COUNT];
+    long pairs[OP_KEY_COUNT][OP_KEY_COUNT];
+    int prev_key;
+    long dispatched;
+};
+
+int op_key(Op o) {
+    if (o.t == OP_BINOP)
+        return OP_COUNT + o.op;
+    if (o.t == OP_INTRINSIC)
+        return OP_COUNT + BT_COUNT + o.op;
+    return o.t;
+}
+
+const char *op_key_name(int key) {
+    if (key >= OP_COUNT)
+        return op_to_str(key < OP_COUNT + BT_COUNT ? (Op){.t = OP_BINOP, .op = key - OP_COUNT} : (Op){.t = OP_INTRINSIC, .op = key - OP_COUNT - BT_COUNT});
+    return op_to_str((Op){.t = key});
+}
+
+void trace_op(ProgramRun *prog, int ip) {
+    SeqProfile *seq = prog->seq;
+    Program p = prog->vm.prog;
+    Op o = VEC_GET(p, ip);
+    seq->dispatched++;
+
+    int key = op_key(o);
+    if (seq->prev_key != -1)
+        seq->pairs[seq->prev_key][key]++;
+    seq->prev_key = key;
+
+    for (int k = 0; k < SI_COUNT; k++) {
+        Peephole ph = superinstrs[k].p;
+        if (ip + ph.len >= p.cnt)
+            continue;
+        bool spans_target = false;
+        for (int j = 1; j < ph.len; j++)
+            spans_target = spans_target || prog->cfg.is_target[ip + j];
+        if (!spans_target && ph.match(p.data + ip))
+            seq->candidates[k]++;
+    }
+}
+
+void print_seq_profile(ProgramRun *prog) {
+    FILE *f = report_out();
+    SeqProfile *seq = prog->seq;
+    fprintf(f, "> Sequence profile: %ld op(s) dispatched\n", seq->dispatched);
+    for (int k = 0; k < SI_COUNT; k++)
+        fprintf(f, "superinstr %-10s %ld\n", superinstrs[k].p.name, seq->candidates[k]);
+
+    // Top pairs, a handful is enough to spot a missing candidate.
+    for (int n = 0; n < 8; n++) {
+        int best_a = -1, best_b = -1;
+        for (int a = 0; a < OP_KEY_COUNT; a++)
+            for (int b = 0; b < OP_KEY_COUNT; b++)
+                if (seq->pairs[a][b] > 0 && (best_a == -1 || seq->pairs[a][b] > seq->pairs[best_a][best_b]))
+                    best_a = a, best_b = b;
+        if (best_a == -1)
+            break;
+        fprintf(f, "pair %s %s %ld\n", op_key_name(best_a), op_key_name(best_b), seq->pairs[best_a][best_b]);
+        seq->pairs[best_a][best_b] = 0;
+    }
+    fprintf(f, "< End Sequence profile.\n");
+}
+// ;seqprofile
+// ;optimizer
+
+// :stats
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Adds the time since `start` to `phase`, returns the start of the next one.
+double lap(ProgramRun *prog, Phase phase, double start) {
+    double end = now_ms();
+    prog->stats.phase_ms[phase] += end - start;
+    return end;
+}
+
+void print_phases(ProgramRun *prog) {
+    FILE *f = report_out();
+    fprintf(f, "> Phases:\n");
+    for (int i = 0; i < PHASE_COUNT; i++)
+        fprintf(f, "phase %-10s %.3f ms\n", phase_names[i], prog->stats.phase_ms[i]);
+    fprintf(f, "< End Phases.\n");
+}
+
+// Dynamic counts behind --stats, taken by count_op after every dispatch.
+struct DispatchCounts {
+    long ops[OP_KEY_COUNT]; // by op_key
+    long libc[LIBC_COUNT];
+    int peak_depth;
+    int peak_bdepth;
+};
+
+void count_op(ProgramRun *prog, int ip, int sp, int bsp) {
+    DispatchCounts *c = prog->counts;
+    Inst in = prog->vm.code[ip];
+    c->ops[op_key((Op){.t = in.t, .op = in.op})]++;
+    if (in.t == OP_LIBC)
+        c->libc[in.op]++;
+    if (sp > c->peak_depth)
+        c->peak_depth = sp;
+    if (bsp > c->peak_bdepth)
+        c->peak_bdepth = bsp;
+}
+
+void print_stats(ProgramRun *prog) {
+    FILE *f = report_out();
+    fprintf(f, "> Stats:\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(f, "phase %-10s %.3f ms", phase_names[i], prog->stats.phase_ms[i]);
+        // Not the selected engine's time, the program ran while counting.
+        if (i == PHASE_RUN && prog->counts != NULL)
+            fprintf(f, " on the counting switch loop");
+        fprintf(f, "\n");
+    }
+    fprintf(f, "tokens %ld\n", prog->stats.tokens);
+    fprintf(f, "ops %ld parsed, %d after optimizing\n", prog->stats.parsed_ops, prog->vm.prog.cnt);
+    for (int i = 0; i < PH_COUNT; i++)
+        fprintf(f, "peephole %-10s removed %ld op(s)\n", peepholes[i].name, prog->stats.peephole[i]);
+    for (int i = 0; i < SI_COUNT; i++)
+        fprintf(f, "superinstr %-10s removed %ld op(s)\n", superinstrs[i].p.name, prog->stats.superinstr[i]);
+    if (prog->stats.jit_size > 0)
+        fprintf(f, "jit %ld byte(s) of code, %ld op(s) fall back to the interpreter\n", prog->stats.jit_size, prog->stats.jit_fallbacks);
+    fprintf(f, "cfg %d block(s)\n", prog->cfg.blocks.cnt);
+    if (prog->counts != NULL)
+        fprintf(f, "engine %s, counted on the switch loop\n", engine_names[prog->stats.engine]);
+    if (prog->stats.alloc_count > 0)
+        fprintf(f, "alloc %ld allocation(s), %ld byte(s) live, %ld byte(s) peak\n", prog->stats.alloc_count, prog->stats.alloc_live, prog->stats.alloc_peak);
+    DispatchCounts *c = prog->counts;
+    if (c != NULL) {
+        for (int k = 0; k < OP_KEY_COUNT; k++) {
+            if (c->ops[k] > 0)
+                fprintf(f, "dispatch %-16s %ld\n", op_key_name(k), c->ops[k]);
+        }
+        for (int i = 0; i < LIBC_COUNT; i++) {
+            if (c->libc[i] > 0)
+                fprintf(f, "libc %-10s %ld call(s)\n", libc_funcs[i].name, c->libc[i]);
+        }
+        fprintf(f, "peak depth %d, back stack %d\n", c->peak_depth, c->peak_bdepth);
+    }
+    fprintf(f, "< End Stats.\n");
+}
+
+// The same report as one JSON object, zero counts included so every key is
+// always there.
+void print_stats_json(ProgramRun *prog) {
+    FILE *f = report_out();
+    Stats *s = &prog->stats;
+    fprintf(f, "{\"phases_ms\": {");
+    for (int i = 0; i < PHASE_COUNT; i++)
+        fprintf(f, "%s\"%s\": %.3f", i > 0 ? ", " : "", phase_names[i], s->phase_ms[i]);
+    // The run phase is the counting switch loop's time, see print_stats.
+    if (prog->counts != NULL)
+        fprintf(f, "}, \"run_timed_on\": \"switch\"");
+    else
+        fprintf(f, "}");
+    fprintf(f, ", \"tokens\": %ld, \"parsed_ops\": %ld, \"ops\": %d", s->tokens, s->parsed_ops, prog->vm.prog.cnt);
+    fprintf(f, ", \"peephole\": {");
+    for (int i = 0; i < PH_COUNT; i++)
+        fprintf(f, "%s\"%s\": %ld", i > 0 ? ", " : "", peepholes[i].name, s->peephole[i]);
+    fprintf(f, "}, \"superinstr\": {");
+    for (int i = 0; i < SI_COUNT; i++)
+        fprintf(f, "%s\"%s\": %ld", i > 0 ? ", " : "", superinstrs[i].p.name, s->superinstr[i]);
+    fprintf(f, "}, \"jit_size\": %ld, \"jit_fallbacks\": %ld, \"cfg_blocks\": %d", s->jit_size, s->jit_fallbacks, prog->cfg.blocks.cnt);
+    fprintf(f, ", \"alloc_count\": %ld, \"alloc_live\": %ld, \"alloc_peak\": %ld", s->alloc_count, s->alloc_live, s->alloc_peak);
+    DispatchCounts *c = prog->counts;
+    if (c != NULL) {
+        fprintf(f, ", \"engine\": \"%s\", \"counted_on\": \"switch\"", engine_names[s->engine]);
+        fprintf(f, ", \"dispatch\": {");
+        // Binops and intrinsics only count under their own keys.
+        for (int k = 0, first = 1; k < OP_KEY_COUNT; k++) {
+            if (k == OP_BINOP || k == OP_INTRINSIC)
+                continue;
+            fprintf(f, "%s\"%s\": %ld", first ? "" : ", ", op_key_name(k), c->ops[k]);
+            first = 0;
+        }
+        fprintf(f, "}, \"libc\": {");
+        for (int i = 0; i < LIBC_COUNT; i++)
+            fprintf(f, "%s\"%s\": %ld", i > 0 ? ", " : "", libc_funcs[i].name, c->libc[i]);
+        fprintf(f, "}, \"peak_depth\": %d, \"peak_back_depth\": %d", c->peak_depth, c->peak_bdepth);
+    }
+    fprintf(f, "}\n");
+}
+// ;stats
+
+// :profile
+// `--profile <prefix>` runs the program on the checked switch loop counting
+// every dispatch per ip. The cycle counter is read before every op and the
+// cycles up to the next one are charged to it, so each op includes the cost
+// of one counter read. Through the Loc of each op they become <prefix>.txt,
+// the hottest ops and every source file annotated line by line, and
+// <prefix>.folded, one stack per op through its enclosing loops and ifs for
+// flamegraph.pl.
+struct Profile {
+    long *count; // per ip
+    uint64_t *cycles; // per ip
+    uint64_t last; // when the op at `prev` started
+    int prev;
+};
+
+// Nanoseconds where there is no cycle counter.
+static inline uint64_t cycles_now(void) {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+Profile *new_profile(ProgramRun *prog) {
+    Profile *p = calloc(1, sizeof(Profile));
+    p->count = calloc(prog->vm.prog.cnt, sizeof(long));
+    p->cycles = calloc(prog->vm.prog.cnt, sizeof(uint64_t));
+    p->prev = -1;
+    return p;
+}
+
+void free_profile(Profile *p) {
+    if (p == NULL)
+        return;
+    free(p->count);
+    free(p->cycles);
+    free(p);
+}
+
+void profile_op(ProgramRun *prog, int ip) {
+    Profile *p = prog->profile;
+    p->count[ip]++;
+    uint64_t now = cycles_now();
+    if (p->prev != -1)
+        p->cycles[p->prev] += now - p->last;
+    p->last = now;
+    p->prev = ip;
+}
+
+// Charges the last op, called once the program reached its end and before
+// the stacks are torn down.
+void profile_stop(ProgramRun *prog) {
+    Profile *p = prog->profile;
+    if (p->prev != -1)
+        p->cycles[p->prev] += cycles_now() - p->last;
+    p->prev = -1;
+}
+
+// Literals by their value, the rest by their syntax.
+const char *profile_name(Op o, char *buf, size_t size) {
+    if (o.t == OP_LIT_NUMBER) {
+        snprintf(buf, size, "%ld", o.op);
+        return buf;
+    }
+    return o.t == OP_LIT_STR ? "string" : op_to_syntax(o);
+}
+
+void write_listing(ProgramRun *prog, FILE *f) {
+    Program p = prog->vm.prog;
+    Profile *prof = prog->profile;
+    uint64_t total = 0;
+    long dispatched = 0;
+    FOR_LIST(p) {
+        total += prof->cycles[i];
+        dispatched += prof->count[i];
+    }
+    double pct = total > 0 ? 100.0 / total : 0;
+    fprintf(f, "%ld op(s) dispatched, %lu cycle(s)\n\nHottest ops:\n", dispatched, total);
+    bool *shown = calloc(p.cnt, sizeof(bool));
+    for (int n = 0; n < 10; n++) {
+        int best = -1;
+        FOR_LIST(p) {
+            if (!shown[i] && prof->count[i] > 0 && (best == -1 || prof->cycles[i] > prof->cycles[best]))
+                best = i;
+        }
+        if (best == -1)
+            break;
+        shown[best] = true;
+        Op o = VEC_GET(p, best);
+        char buf[32];
+        fprintf(f, "%5.1f%% %14lu cycle(s) %12ld time(s) %s:%d:%d %s\n", prof->cycles[best] * pct, prof->cycles[best],
+                prof->count[best], o.l.path, o.l.row, o.l.col, profile_name(o, buf, sizeof(buf)));
+    }
+    free(shown);
+
+    // Every file some executed op came from, in the order they first show up.
+    for (int first = 0; first < p.cnt; first++) {
+        const char *path = VEC_GET(p, first).l.path;
+        bool seen = prof->count[first] == 0;
+        for (int i = 0; i < first && !seen; i++)
+            seen = prof->count[i] > 0 && strcmp(VEC_GET(p, i).l.path, path) == 0;
+        if (seen)
+            continue;
+
+        int rows = 0;
+        FOR_LIST(p) {
+            Op o = VEC_GET(p, i);
+            if (strcmp(o.l.path, path) == 0 && o.l.row > rows)
+                rows = o.l.row;
+        }
+        long *count = calloc(rows + 1, sizeof(long));
+        uint64_t *cycles = calloc(rows + 1, sizeof(uint64_t));
+        FOR_LIST(p) {
+            Op o = VEC_GET(p, i);
+            if (strcmp(o.l.path, path) == 0 && o.l.row > 0) {
+                count[o.l.row] += prof->count[i];
+                cycles[o.l.row] += prof->cycles[i];
+            }
+        }
+
+        fprintf(f, "\n==> %s <==\n%12s %14s %6s %5s\n", path, "ops", "cycles", "", "line");
+        size_t len = 0;
+        char *code = access(path, R_OK) == 0 ? read_file_as_cstr(path, &len) : NULL;
+        const char *line = code;
+        for (int row = 1; row <= rows || (line != NULL && line < code + len); row++) {
+            const char *end = line != NULL ? memchr(line, '\n', code + len - line) : NULL;
+            if (line != NULL && end == NULL)
+                end = code + len;
+            int width = line != NULL ? (int)(end - line) : 0;
+            if (row <= rows && count[row] > 0)
+                fprintf(f, "%12ld %14lu %5.1f%% %5d | %.*s\n", count[row], cycles[row], cycles[row] * pct, row, width, line);
+            else
+                fprintf(f, "%12s %14s %6s %5d | %.*s\n", "", "", "", row, width, line != NULL ? line : "");
+            if (line != NULL)
+                line = end < code + len ? end + 1 : NULL;
+        }
+        free(code);
+        free(count);
+        free(cycles);
+    }
+}
+
+void write_folded(ProgramRun *prog, FILE *f) {
+    Program p = prog->vm.prog;
+    Profile *prof = prog->profile;
+    IntList open = {0}; // the loops and ifs around the op
+    char buf[32];
+    FOR_LIST(p) {
+        Op o = VEC_GET(p, i);
+        if (prof->cycles[i] > 0) {
+            fprintf(f, "%s", o.l.path);
+            for (int k = 0; k < open.cnt; k++) {
+                Op c = VEC_GET(p, VEC_GET(open, k));
+                fprintf(f, ";%s %d:%d", op_to_syntax(c), c.l.row, c.l.col);
+            }
+            fprintf(f, ";%d:%d %s %lu\n", o.l.row, o.l.col, profile_name(o, buf, sizeof(buf)), prof->cycles[i]);
+        }
+        if (is_intrinsic(o, W_LOOP) || is_intrinsic(o, W_IF))
+            VEC_ADD(&open, i);
+        else if ((is_intrinsic(o, W_END) || is_intrinsic(o, W_ENDIF)) && open.cnt > 0)
+            open.cnt--;
+    }
+    VEC_FREE(open);
+}
+
+void print_profile(ProgramRun *prog) {
+    const char *prefix = prog->opts.profile;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.txt", prefix);
+    FILE *listing = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    FILE *folded = fopen(path, "w");
+    if (listing == NULL || folded == NULL) {
+        fprintf(run_out(), "Can't write the profile to %s.txt and %s.folded.\n", prefix, prefix);
+    } else {
+        write_listing(prog, listing);
+        write_folded(prog, folded);
+        fprintf(report_out(), "> Profile written to %s.txt and %s.folded\n", prefix, prefix);
+    }
+    if (listing != NULL)
+        fclose(listing);
+    if (folded != NULL)
+        fclose(folded);
+}
+// ;profile
+
+void clean_program_run(ProgramRun *prog) {
+    free_symbols(&prog->syms);
+    free(prog->strs.data);
+    VEC_FREE(prog->sym_defines);
+    free(prog->seq);
+    free(prog->counts);
+    free_profile(prog->profile);
+    free_cfg(&prog->cfg);
+    VEC_FREE(prog->vm.prog);
+    free(prog->vm.code);
+    untrack_map(prog->vm.mem);
+    munmap(prog->vm.mem, heap_size);
+    free_allocator(prog);
+    VEC_FREE(prog->tokens);
+    VEC_FREE(prog->defines);
+    FOR_LIST(prog->deps) {
+        free(VEC_GET(prog->deps, i).path);
+        free(VEC_GET(prog->deps, i).real);
+    }
+    VEC_FREE(prog->deps);
+    free(prog->code);
+}
+
+long stat_mtime(struct stat st) {
+    return st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec;
+}
+
+Dep make_dep(const char *path, const char *code, size_t len) {
+    struct stat st = {0};
+    _ stat(path, &st);
+    char real[PATH_MAX];
+    if (realpath(path, real) == NULL)
+        snprintf(real, sizeof(real), "%s", path);
+    return (Dep){strdup(path), strdup(real), hash_bytes(code, len), st.st_size, stat_mtime(st)};
+}
+
+// Copies the final program into vm.code, must run again if vm.prog changes.
+void build_code(VM *vm) {
+    free(vm->code);
+    vm->code = malloc(sizeof(Inst) * vm->prog.cnt);
+    FOR_LIST(vm->prog) {
+        Op o = VEC_GET(vm->prog, i);
+        vm->code[i] = (Inst){o.op, o.link, o.t, o.sub};
+    }
+}
+
+// read_file_as_cstr would report a missing file on stdout, past run_out().
+char *read_source(const char *path, size_t *len) {
+    char *code = access(path, R_OK) == 0 ? read_file_as_cstr(path, len) : NULL;
+    if (code == NULL) {
+        fprintf(run_out(), "Failed to open file %s\n", path);
+        fail(1);
+    }
+    return code;
+}
+
+// Tokenizes and parses `path` into `res`, merges its includes and resolves
+// its defines. That is all a module needs, compile_program goes on from
+// there. When it fails `res` holds what was built so far, clean_program_run
+// frees it.
+void compile_front(const char *path, Options opts, const IncludeChain *chain, ProgramRun *res) {
+    *res = (ProgramRun){0};
+    res->opts = opts;
+    res->chain = chain;
+    res->out = run_out();
+    size_t len;
+    res->code = read_source(path, &len);
+    res->vm.mem = heap_map();
+    VEC_ADD(&res->deps, make_dep(path, res->code, len));
+    double t = now_ms();
+    tokenize(res->code, len, path, &res->tokens);
+    t = lap(res, PHASE_TOKENIZE, t);
+    res->stats.tokens = res->tokens.cnt;
+
+    init_symbols(res);
+    parse(res);
+    t = lap(res, PHASE_PARSE, t);
+    res->stats.parsed_ops = res->vm.prog.cnt;
+
+    process_include(res);
+    t = lap(res, PHASE_INCLUDE, t);
+
+#ifdef DEBUG
+    // print_operations(vm);
+#endif
+    if (!replace_defined(res))
+        fail(1);
+
+    lap(res, PHASE_DEFINE, t);
+}
+
+// Runs the whole front end without executing the program, see compile_front.
+void compile_program(const char *path, Options opts, ProgramRun *res) {
+    compile_front(path, opts, NULL, res);
+    double t = now_ms();
+    control_flow_link(&res->vm);
+    res->cfg = build_cfg(res->vm.prog);
+    t = lap(res, PHASE_LINK, t);
+
+    res->verified = verify_stack(res);
+    t = lap(res, PHASE_VERIFY, t);
+
+    optimize(res);
+    select_superinstructions(res);
+    build_code(&res->vm);
+    lap(res, PHASE_OPTIMIZE, t);
+
+#ifdef DEBUG
+    print_operations(*res);
+#endif
+}
+
+// Runs a compiled program, with the reports its options ask for.
+void run_compiled(ProgramRun *res) {
+    Options opts = res->opts;
+    if (opts.seq_profile) {
+        // Candidates are counted on the checked switch loop, before fusing.
+        res->opts.engine = ENGINE_SWITCH;
+        res->seq = calloc(1, sizeof(SeqProfile));
+        res->seq->prev_key = -1;
+    } else if (opts.profile != NULL) {
+        // Profiled on the checked switch loop too, after fusing.
+        res->opts.engine = ENGINE_SWITCH;
+        res->profile = new_profile(res);
+    } else if (opts.stats) {
+        // Dispatches are counted on the checked switch loop, after fusing.
+        // The report names the selected engine too.
+        res->stats.engine = opts.engine;
+        if (opts.engine == ENGINE_JIT)
+            measure_jit(res);
+        res->opts.engine = ENGINE_SWITCH;
+        res->counts = calloc(1, sizeof(DispatchCounts));
+    }
+
+    double t = now_ms();
+    interpet(res);
+    lap(res, PHASE_RUN, t);
+
+    if (opts.time && !opts.stats)
+        print_phases(res);
+    if (opts.stats_json)
+        print_stats_json(res);
+    else if (opts.stats)
+        print_stats(res);
+    if (res->seq != NULL)
+        print_seq_profile(res);
+    if (res->profile != NULL)
+        print_profile(res);
+}
+
+ProgramRun run_program(const char *path, Options opts) {
+    ProgramRun res;
+    compile_program(path, opts, &res);
+    run_compiled(&res);
+    return res;
+}
+
+// :image
+// Precompiled program image (.cco), written by `main compile` and loaded
+// straight into `interpet`. Layout, every section 8 byte aligned:
+//   ImageHeader | ImageDep[dep_cnt] | ImageOp[op_cnt] | ImageDefine[define_cnt] | mem[mem_size] | strings[str_size]
+// Every string is stored as an offset into the trailing string pool.
+#define IMAGE_MAGIC "CCO\x7f"
+#define IMAGE_VERSION 4
+// Any change to the opcode tables invalidates the stored operands.
+#define IMAGE_LAYOUT ((OP_COUNT << 24) | (W_COUNT << 16) | (BT_COUNT << 8) | sizeof(long))
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t layout;
+    uint32_t dep_cnt;
+    uint32_t op_cnt;
+    uint32_t define_cnt;
+    uint32_t mem_size;
+    uint32_t str_size;
+} ImageHeader;
+
+typedef struct {
+    uint64_t hash;
+    int64_t size;
+    int64_t mtime;
+    uint32_t path;
+    uint32_t pad;
+} ImageDep;
+
+typedef struct {
+    int64_t op;
+    int32_t t;
+    int32_t sub;
+    int32_t link;
+    uint32_t path;
+    int32_t row;
+    int32_t col;
+    uint32_t repr;
+    uint32_t pad;
+} ImageOp;
+
+typedef struct {
+    int64_t val;
+    int32_t type;
+    int32_t link;
+    uint32_t name;
+    uint32_t addr;
+} ImageDefine;
+
+static_assert(sizeof(ImageHeader) % 8 == 0, "Image sections must stay aligned");
+static_assert(sizeof(ImageDep) % 8 == 0, "Image sections must stay aligned");
+static_assert(sizeof(ImageOp) % 8 == 0, "Image sections must stay aligned");
+static_assert(sizeof(ImageDefine) % 8 == 0, "Image sections must stay aligned");
+
+uint32_t image_str(ByteList *pool, const char *str) {
+    uint32_t at = pool->cnt;
+    size_t len = strlen(str);
+    for (size_t i = 0; i <= len; i++)
+        VEC_ADD(pool, str[i]);
+    return at;
+}
+
+size_t image_pad(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+bool write_image(ProgramRun *prog, const char *out_path) {
+    ByteList pool = {0};
+    image_str(&pool, "");
+
+    ImageHeader h = {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .layout = IMAGE_LAYOUT,
+        .dep_cnt = prog->deps.cnt,
+        .op_cnt = prog->vm.prog.cnt,
+        .define_cnt = prog->defines.cnt,
+        .mem_size = prog->vm.mem_ptr,
+    };
+
+    ImageDep *deps = calloc(h.dep_cnt, sizeof(ImageDep));
+    FOR_LIST(prog->deps) {
+        Dep d = VEC_GET(prog->deps, i);
+        deps[i] = (ImageDep){d.hash, d.size, d.mtime, image_str(&pool, d.path), 0};
+    }
+
+    ImageOp *ops = calloc(h.op_cnt, sizeof(ImageOp));
+    const char *last_path = NULL;
+    uint32_t last_path_at = 0;
+    FOR_LIST(prog->vm.prog) {
+        Op o = VEC_GET(prog->vm.prog, i);
+        if (o.l.path != last_path) {
+            last_path = o.l.path;
+            last_path_at = image_str(&pool, o.l.path);
+        }
+        // Only words still unresolved after linking need their text at run time.
+        uint32_t repr = 0;
+        if (is_intrinsic(o, W_DEFINED))
+            repr = image_str(&pool, TOKEN_LIT(*prog, o.index));
+        ops[i] = (ImageOp){o.op, o.t, o.sub, o.link, last_path_at, o.l.row, o.l.col, repr, 0};
+    }
+
+    ImageDefine *defines = calloc(h.define_cnt, sizeof(ImageDefine));
+    FOR_LIST(prog->defines) {
+        DefineData d = VEC_GET(prog->defines, i);
+        defines[i] = (ImageDefine){d.val, d.type, d.link, image_str(&pool, CSTR(&prog->strs, d.lit_ptr)), d.addr};
+    }
+
+    h.str_size = image_pad(pool.cnt);
+    while ((uint32_t)pool.cnt < h.str_size)
+        VEC_ADD(&pool, 0);
+
+    bool ok = false;
+    FILE *f = fopen(out_path, "wb");
+    if (f == NULL) {
+        fprintf(run_out(), "Error: Can't open %s for writing.\n", out_path);
+    } else {
+        char zeros[8] = {0};
+        ok = fwrite(&h, sizeof(h), 1, f) == 1;
+        ok = ok && fwrite(deps, sizeof(ImageDep), h.dep_cnt, f) == h.dep_cnt;
+        ok = ok && fwrite(ops, sizeof(ImageOp), h.op_cnt, f) == h.op_cnt;
+        ok = ok && fwrite(defines, sizeof(ImageDefine), h.define_cnt, f) == h.define_cnt;
+        ok = ok && fwrite(prog->vm.mem, 1, h.mem_size, f) == h.mem_size;
+        ok = ok && fwrite(zeros, 1, image_pad(h.mem_size) - h.mem_size, f) == image_pad(h.mem_size) - h.mem_size;
+        ok = ok && fwrite(pool.data, 1, h.str_size, f) == h.str_size;
+        ok = (fclose(f) == 0) && ok;
+        if (!ok)
+            fprintf(run_out(), "Error: Failed to write image %s.\n", out_path);
+    }
+
+    free(deps);
+    free(ops);
+    free(defines);
+    VEC_FREE(pool);
+    return ok;
+}
+
+bool is_image(const char *path) {
+    char magic[4] = {0};
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    ssize_t n = read(fd, magic, sizeof(magic));
+    close(fd);
+    return n == sizeof(magic) && memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+// An image is stale when one of the sources it was compiled from still exists
+// but no longer has the same contents.
+bool image_dep_is_fresh(const char *path, ImageDep d) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return true;
+    if (st.st_size == d.size && stat_mtime(st) == d.mtime)
+        return true;
+    size_t len;
+    char *code = read_file_as_cstr(path, &len);
+    if (code == NULL)
+        return true;
+    bool fresh = hash_bytes(code, len) == d.hash;
+    free(code);
+    return fresh;
+}
+
+// Every operand that indexes a table, the program or `mem` has to be in range,
+// the engines trust them.
+bool image_op_is_valid(ImageOp io, uint32_t op_cnt, uint32_t mem_size) {
+    Op o = {.t = io.t, .op = io.op, .sub = io.sub, .link = io.link};
+    if (io.t < 0 || io.t >= OP_COUNT)
+        return false;
+    if (has_link(o) && (io.link < 0 || (uint32_t)io.link >= op_cnt))
+        return false;
+    switch (io.t) {
+    case OP_BINOP:
+        return io.op >= 0 && io.op < BT_COUNT;
+    case OP_BINOP_IMM:
+    case OP_CMP_DO:
+        return io.sub >= 0 && io.sub < BT_COUNT;
+    case OP_INTRINSIC:
+        return io.op >= 0 && io.op < W_COUNT;
+    case OP_LIBC:
+        return io.op >= 0 && io.op < LIBC_COUNT;
+    case OP_LIT_STR:
+        return io.op >= 0 && io.op <= mem_size;
+    case OP_LOAD:
+        return io.sub >= 0 && io.sub <= (int)sizeof(long) && io.op >= 0 && (uint64_t)io.op + io.sub <= heap_size;
+    case OP_STORE:
+        return io.op >= 0 && (uint64_t)io.op + sizeof(long) <= heap_size;
+    default:
+        return true;
+    }
+}
+
+bool load_image(const char *path, ProgramRun *res) {
+    size_t len;
+    char *data = read_file_as_cstr(path, &len);
+    if (data == NULL)
+        return false;
+
+    ImageHeader h;
+    if (len < sizeof(h) || memcmp(data, IMAGE_MAGIC, 4) != 0) {
+        fprintf(run_out(), "Error: %s is not a concat image.\n", path);
+        free(data);
+        return false;
+    }
+    memcpy(&h, data, sizeof(h));
+
+    if (h.version != IMAGE_VERSION || h.layout != IMAGE_LAYOUT) {
+        fprintf(run_out(), "Error: %s was built by an incompatible concat, recompile it.\n", path);
+        free(data);
+        return false;
+    }
+
+    uint64_t expected = sizeof(h) + (uint64_t)h.dep_cnt * sizeof(ImageDep) + (uint64_t)h.op_cnt * sizeof(ImageOp) + (uint64_t)h.define_cnt * sizeof(ImageDefine) + image_pad(h.mem_size) + h.str_size;
+    if (expected != len || h.str_size == 0 || h.op_cnt == 0) {
+        fprintf(run_out(), "Error: %s is truncated or corrupted.\n", path);
+        free(data);
+        return false;
+    }
+    if (h.mem_size > heap_size) {
+        fprintf(run_out(), "Error: %s needs a heap of %u bytes, the limit is %zu. Raise it with --heap.\n", path, h.mem_size, heap_size);
+        free(data);
+        return false;
+    }
+
+    ImageDep *deps = (ImageDep *)(data + sizeof(h));
+    ImageOp *ops = (ImageOp *)(deps + h.dep_cnt);
+    ImageDefine *defines = (ImageDefine *)(ops + h.op_cnt);
+    char *mem = (char *)(defines + h.define_cnt);
+    char *strs = mem + image_pad(h.mem_size);
+    strs[h.str_size - 1] = 0;
+
+    // Execution stops at the final OP_NOP, there has to be one.
+    bool valid = ops[h.op_cnt - 1].t == OP_NOP;
+    for (uint32_t i = 0; i < h.op_cnt && valid; i++)
+        valid = image_op_is_valid(ops[i], h.op_cnt, h.mem_size);
+    for (uint32_t i = 0; i < h.define_cnt && valid; i++) {
+        ImageDefine d = defines[i];
+        valid = d.type >= 0 && d.type < OP_COUNT;
+        if (valid && d.type == OP_INTRINSIC && d.val == W_DEFINED)
+            valid = d.link >= 0 && (uint32_t)d.link < h.define_cnt;
+    }
+    if (!valid) {
+        fprintf(run_out(), "Error: %s is truncated or corrupted.\n", path);
+        free(data);
+        return false;
+    }
+
+#define IMAGE_STR(off) ((off) < h.str_size ? strs + (off) : strs)
+
+    for (uint32_t i = 0; i < h.dep_cnt; i++) {
+        const char *dep = IMAGE_STR(deps[i].path);
+        if (!image_dep_is_fresh(dep, deps[i])) {
+            fprintf(run_out(), "Error: %s is stale, %s changed since it was compiled.\n", path, dep);
+            free(data);
+            return false;
+        }
+    }
+
+    *res = (ProgramRun){0};
+    res->out = run_out();
+    // Keep the image around, every Loc path points into its string pool.
+    res->code = data;
+    for (uint32_t i = 0; i < h.dep_cnt; i++) {
+        ImageDep d = deps[i];
+        const char *dep = IMAGE_STR(d.path);
+        VEC_ADD(&res->deps, ((Dep){strdup(dep), strdup(dep), d.hash, d.size, d.mtime}));
+    }
+
+    VEC_ADD(&res->tokens, make_token(TT_WORD, 0, 0, LOC(path, 0, 0), 0));
+    for (uint32_t i = 0; i < h.op_cnt; i++) {
+        ImageOp io = ops[i];
+        Op o = {LOC(IMAGE_STR(io.path), io.col, io.row), io.t, io.sub, io.op, io.link, 0};
+        if (io.repr != 0) {
+            const char *repr = IMAGE_STR(io.repr);
+            o.index = res->tokens.cnt;
+            Token t = make_token(TT_WORD, repr - data, strlen(repr), o.l, o.index);
+            t.sym = intern(&res->syms, &res->strs, repr, t.len);
+            VEC_ADD(&res->tokens, t);
+        }
+        VEC_ADD(&res->vm.prog, o);
+    }
+
+    for (uint32_t i = 0; i < h.define_cnt; i++) {
+        ImageDefine d = defines[i];
+        const char *name = IMAGE_STR(d.name);
+        DefineData data = {i, d.val, d.type, 0, d.link, -1, d.addr};
+        data.sym = intern(&res->syms, &res->strs, name, strlen(name));
+        data.lit_ptr = VEC_GET(res->syms.names, data.sym);
+        add_define(res, data);
+    }
+#undef IMAGE_STR
+
+    res->vm.mem = heap_map();
+    memcpy(res->vm.mem, mem, h.mem_size);
+    res->vm.mem_ptr = h.mem_size;
+
+    res->cfg = build_cfg(res->vm.prog);
+    res->verified = verify_stack(res);
+    build_code(&res->vm);
+
+    return true;
+}
+// ;image
+
+// :modules
+// Included files are compiled once per process and never run, only their
+// defines are merged into the includer. Modules stay in memory keyed by
+// canonical path, with `--module-cache <dir>` also on disk keyed by the hash
+// of their source. A cached module is only used while every file it was
+// compiled from is unchanged. The includes of a file are compiled in
+// parallel, see process_include.
+typedef struct {
+    char *path;     // canonical
+    bool compiling; // by some include, until then the others use a copy
+    Defines defines; // names in strs, `addr` values are offsets into mem
+    StrArena strs;
+    Deps deps; // the file itself first, then everything it included
+    char *mem; // the start of the bytes its strings and `mem` reserve
+    size_t mem_len;
+    size_t mem_size;
+} Module;
+List(Modules, Module *);
+
+Modules modules; // guarded by modules_lock, a Module never moves
+pthread_mutex_t modules_lock = PTHREAD_MUTEX_INITIALIZER;
+const char *module_cache_dir = NULL;
+
+#define MODULE_MAGIC "CCM\x7f"
+
+// Module cache file, the image sections a module needs:
+//   ModuleHeader | ImageDep[dep_cnt] | ImageDefine[define_cnt] | mem[mem_len] | strings[str_size]
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t layout;
+    uint32_t dep_cnt;
+    uint32_t define_cnt;
+    uint32_t mem_len;
+    uint32_t mem_size;
+    uint32_t str_size;
+} ModuleHeader;
+
+static_assert(sizeof(ModuleHeader) % 8 == 0, "Image sections must stay aligned");
+
+void module_cache_path(char *buf, size_t cap, uint64_t hash) {
+    snprintf(buf, cap, "%s/%016lx.ccm", module_cache_dir, (unsigned long)hash);
+}
+
+// Dependencies are stored canonical, the cache can be read from anywhere.
+void write_module_cache(Module *m, uint64_t hash) {
+    ByteList pool = {0};
+    image_str(&pool, "");
+
+    ModuleHeader h = {
+        .magic = MODULE_MAGIC,
+        .version = IMAGE_VERSION,
+        .layout = IMAGE_LAYOUT,
+        .dep_cnt = m->deps.cnt,
+        .define_cnt = m->defines.cnt,
+        .mem_len = m->mem_len,
+        .mem_size = m->mem_size,
+    };
+
+    ImageDep *deps = calloc(h.dep_cnt, sizeof(ImageDep));
+    FOR_LIST(m->deps) {
+        Dep d = VEC_GET(m->deps, i);
+        deps[i] = (ImageDep){d.hash, d.size, d.mtime, image_str(&pool, d.real), 0};
+    }
+    ImageDefine *defines = calloc(h.define_cnt, sizeof(ImageDefine));
+    FOR_LIST(m->defines) {
+        DefineData d = VEC_GET(m->defines, i);
+        defines[i] = (ImageDefine){d.val, d.type, d.link, image_str(&pool, CSTR(&m->strs, d.lit_ptr)), d.addr};
+    }
+    h.str_size = image_pad(pool.cnt);
+    while ((uint32_t)pool.cnt < h.str_size)
+        VEC_ADD(&pool, 0);
+
+    // Written aside and renamed, a reader never sees half a module.
+    char path[PATH_MAX], tmp[PATH_MAX + 16];
+    module_cache_path(path, sizeof(path), hash);
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (f != NULL) {
+        char zeros[8] = {0};
+        bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+        ok = ok && fwrite(deps, sizeof(ImageDep), h.dep_cnt, f) == h.dep_cnt;
+        ok = ok && fwrite(defines, sizeof(ImageDefine), h.define_cnt, f) == h.define_cnt;
+        ok = ok && fwrite(m->mem, 1, h.mem_len, f) == h.mem_len;
+        ok = ok && fwrite(zeros, 1, image_pad(h.mem_len) - h.mem_len, f) == image_pad(h.mem_len) - h.mem_len;
+        ok = ok && fwrite(pool.data, 1, h.str_size, f) == h.str_size;
+        ok = (fclose(f) == 0) && ok;
+        if (!ok || rename(tmp, path) != 0)
+            unlink(tmp);
+    }
+
+    free(deps);
+    free(defines);
+    VEC_FREE(pool);
+}
+
+// A missing, stale or broken cache entry is a miss, the module is compiled.
+bool read_module_cache(Module *m, uint64_t hash) {
+    char path[PATH_MAX];
+    module_cache_path(path, sizeof(path), hash);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    close(fd);
+
+    size_t len;
+    char *data = read_file_as_cstr(path, &len);
+    if (data == NULL)
+        return false;
+
+    ModuleHeader h;
+    bool ok = len >= sizeof(h);
+    if (ok) {
+        memcpy(&h, data, sizeof(h));
+        ok = memcmp(h.magic, MODULE_MAGIC, 4) == 0 && h.version == IMAGE_VERSION && h.layout == IMAGE_LAYOUT;
+    }
+    ok = ok && sizeof(h) + (uint64_t)h.dep_cnt * sizeof(ImageDep) + (uint64_t)h.define_cnt * sizeof(ImageDefine) + image_pad(h.mem_len) + h.str_size == len;
+    ok = ok && h.str_size > 0 && h.dep_cnt > 0 && h.mem_len <= h.mem_size;
+    if (!ok) {
+        free(data);
+        return false;
+    }
+
+    ImageDep *deps = (ImageDep *)(data + sizeof(h));
+    ImageDefine *defines = (ImageDefine *)(deps + h.dep_cnt);
+    char *mem = (char *)(defines + h.define_cnt);
+    char *strs = mem + image_pad(h.mem_len);
+    strs[h.str_size - 1] = 0;
+
+#define MODULE_STR(off) ((off) < h.str_size ? strs + (off) : strs)
+    for (uint32_t i = 0; i < h.dep_cnt && ok; i++)
+        ok = image_dep_is_fresh(MODULE_STR(deps[i].path), deps[i]);
+
+    for (uint32_t i = 0; i < h.dep_cnt && ok; i++) {
+        ImageDep d = deps[i];
+        const char *dep = MODULE_STR(d.path);
+        VEC_ADD(&m->deps, ((Dep){strdup(dep), strdup(dep), d.hash, d.size, d.mtime}));
+    }
+    for (uint32_t i = 0; i < h.define_cnt && ok; i++) {
+        ImageDefine d = defines[i];
+        const char *name = MODULE_STR(d.name);
+        DefineData data = {i, d.val, d.type, str_push(&m->strs, name, strlen(name)), d.link, -1, d.addr};
+        VEC_ADD(&m->defines, data);
+    }
+#undef MODULE_STR
+
+    if (ok) {
+        m->mem = malloc(h.mem_len);
+        memcpy(m->mem, mem, h.mem_len);
+        m->mem_len = h.mem_len;
+        m->mem_size = h.mem_size;
+    }
+    free(data);
+    return ok;
+}
+
+// Keeps what an includer needs from a compiled file.
+void module_from_run(Module *m, ProgramRun *run) {
+    FOR_LIST(run->defines) {
+        DefineData d = VEC_GET(run->defines, i);
+        d.lit_ptr = str_push(&m->strs, CSTR(&run->strs, d.lit_ptr), str_len(&run->strs, d.lit_ptr));
+        VEC_ADD(&m->defines, d);
+    }
+    FOR_LIST(run->deps) {
+        Dep d = VEC_GET(run->deps, i);
+        d.path = strdup(d.path);
+        d.real = strdup(d.real);
+        VEC_ADD(&m->deps, d);
+    }
+    m->mem_len = mem_init_len(&run->vm);
+    m->mem_size = run->vm.mem_ptr;
+    m->mem = malloc(m->mem_len);
+    memcpy(m->mem, run->vm.mem, m->mem_len);
+}
+
+void free_module(Module *m) {
+    free(m->path);
+    VEC_FREE(m->defines);
+    free(m->strs.data);
+    FOR_LIST(m->deps) {
+        free(VEC_GET(m->deps, i).path);
+        free(VEC_GET(m->deps, i).real);
+    }
+    VEC_FREE(m->deps);
+    free(m->mem);
+    free(m);
+}
+
+// Forgets a shared module whose compile failed, the next include of it
+// compiles it again. Nobody else holds it, it was never done compiling.
+void drop_module(Module *shared) {
+    pthread_mutex_lock(&modules_lock);
+    FOR_LIST(modules) {
+        if (VEC_GET(modules, i) == shared) {
+            VEC_GET(modules, i) = VEC_GET(modules, modules.cnt - 1);
+            modules.cnt--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&modules_lock);
+    free_module(shared);
+}
+
+// Returns the module for `real`, the canonical form of `path`. `owned` is
+// set when the caller got a private copy it has to free: while another
+// include still compiles the shared one it is compiled again rather than
+// waited on, two includes waiting on each other would never finish.
+Module *load_module(const char *path, const char *real, Options opts, const IncludeChain *chain, bool *owned) {
+    for (const IncludeChain *c = chain; c != NULL; c = c->parent) {
+        if (strcmp(c->real, real) == 0) {
+            fprintf(run_out(), "Error: Include cycle through %s.\n", path);
+            fail(1);
+        }
+    }
+
+    pthread_mutex_lock(&modules_lock);
+    Module *shared = NULL;
+    FOR_LIST(modules) {
+        if (strcmp(VEC_GET(modules, i)->path, real) == 0)
+            shared = VEC_GET(modules, i);
+    }
+    if (shared != NULL && !shared->compiling) {
+        pthread_mutex_unlock(&modules_lock);
+        *owned = false;
+        return shared;
+    }
+    *owned = shared != NULL;
+    if (shared == NULL) {
+        shared = calloc(1, sizeof(Module));
+        shared->path = strdup(real);
+        shared->compiling = true;
+        VEC_ADD(&modules, shared);
+    }
+    pthread_mutex_unlock(&modules_lock);
+
+    Module *m = calloc(1, sizeof(Module));
+    m->path = strdup(real);
+    ProgramRun *run = calloc(1, sizeof(ProgramRun));
+
+    // A failing compile unwinds through here before it reaches the includer.
+    sigjmp_buf *outer = run_ctx.fail;
+    sigjmp_buf jmp;
+    run_ctx.fail = &jmp;
+    if (sigsetjmp(jmp, 1) != 0) {
+        run_ctx.fail = outer;
+        clean_program_run(run);
+        free(run);
+        free_module(m);
+        if (!*owned)
+            drop_module(shared);
+        fail(run_ctx.status);
+    }
+
+    uint64_t hash = 0;
+    bool cached = false;
+    if (module_cache_dir != NULL) {
+        size_t len;
+        char *code = read_source(path, &len);
+        hash = hash_bytes(code, len);
+        free(code);
+        cached = read_module_cache(m, hash);
+    }
+
+    if (!cached) {
+        IncludeChain link = {real, chain};
+        compile_front(path, opts, &link, run);
+        module_from_run(m, run);
+        clean_program_run(run);
+        if (module_cache_dir != NULL && !*owned)
+            write_module_cache(m, hash);
+    }
+    run_ctx.fail = outer;
+    free(run);
+
+    if (*owned)
+        return m;
+    pthread_mutex_lock(&modules_lock);
+    free(shared->path);
+    *shared = *m;
+    pthread_mutex_unlock(&modules_lock);
+    free(m);
+    return shared;
+}
+
+// The canonical path of every file already merged into `prog`, itself
+// included, so each one is only included once.
+bool is_included(ProgramRun *prog, const char *real) {
+    FOR_LIST(prog->deps) {
+        if (strcmp(VEC_GET(prog->deps, i).real, real) == 0)
+            return true;
+    }
+    return false;
+}
+
+void merge_module(ProgramRun *prog, Module *m) {
+    // Its strings and `mem` buffers move to the end of the includer's.
+    size_t base = (prog->vm.mem_ptr + 7) & ~(size_t)7;
+    if (base + m->mem_size > heap_size) {
+        fprintf(run_out(), "Error: Out of memory including %s, the limit is %zu bytes.\n", m->path, heap_size);
+        fail(1);
+    }
+    memcpy(prog->vm.mem + base, m->mem, m->mem_len);
+    prog->vm.mem_ptr = base + m->mem_size;
+
+    int first = prog->defines.cnt;
+    FOR_LIST(m->defines) {
+        DefineData data = VEC_GET(m->defines, i);
+        data.index += first;
+        data.sym = intern(&prog->syms, &prog->strs, CSTR(&m->strs, data.lit_ptr), str_len(&m->strs, data.lit_ptr));
+        data.lit_ptr = VEC_GET(prog->syms.names, data.sym);
+        if (data.type == OP_INTRINSIC && data.val == W_DEFINED)
+            data.link += first;
+        if (data.addr)
+            data.val += base;
+        add_define(prog, data);
+    }
+    FOR_LIST(m->deps) {
+        Dep d = VEC_GET(m->deps, i);
+        if (is_included(prog, d.real))
+            continue;
+        d.path = strdup(d.path);
+        d.real = strdup(d.real);
+        VEC_ADD(&prog->deps, d);
+    }
+}
+
+// Extra threads in use by the includes of every file, nested ones included,
+// so their total stays below the cpu count however deep includes go.
+int include_threads = 0;
+
+// Returns how many of `want` threads may be started, give them back with
+// release_include_threads.
+int claim_include_threads(int want) {
+    int cap = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    int used = __atomic_load_n(&include_threads, __ATOMIC_RELAXED);
+    int got;
+    do {
+        got = cap - used < want ? cap - used : want;
+        if (got <= 0)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&include_threads, &used, used + got, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return got;
+}
+
+void release_include_threads(int cnt) {
+    __atomic_sub_fetch(&include_threads, cnt, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+    const char *path;
+    char real[PATH_MAX];
+    Module *m;
+    bool owned;
+} IncludeJob;
+List(IncludeJobs, IncludeJob);
+
+typedef struct {
+    IncludeJob *jobs;
+    int cnt;
+    int next; // claimed atomically
+    ProgramRun *includer;
+    FILE *out; // the includer's run_out()
+    int status; // of the first include that failed, 0 if none did
+} IncludePool;
+
+// Workers report to the includer's output, a failing include stops the pool
+// and process_include fails the includer with its status once all joined.
+void *include_worker(void *arg) {
+    IncludePool *pool = arg;
+    RunCtx saved = run_ctx;
+    sigjmp_buf jmp;
+    run_ctx = (RunCtx){.out = pool->out, .fail = &jmp};
+    if (sigsetjmp(jmp, 1) != 0) {
+        release_run();
+        int none = 0;
+        __atomic_compare_exchange_n(&pool->status, &none, run_ctx.status, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        __atomic_store_n(&pool->next, pool->cnt, __ATOMIC_RELAXED);
+        run_ctx = saved;
+        return NULL;
+    }
+    for (;;) {
+        int i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= pool->cnt)
+            break;
+        IncludeJob *job = &pool->jobs[i];
+        job->m = load_module(job->path, job->real, pool->includer->opts, pool->includer->chain, &job->owned);
+    }
+    run_ctx = saved;
+    return NULL;
+}
+
+// Compiles every file `current` includes on the calling thread and the ones
+// claim_include_threads grants, then merges them in source order, so the
+// defines come out the same as one at a time.
+// A file some earlier include already pulled in is compiled but not merged.
+void process_include(ProgramRun *current) {
+    bool *dead = calloc(current->vm.prog.cnt + 1, sizeof(bool));
+    IncludeJobs jobs = {0};
+    FOR_LIST(current->vm.prog) {
+        Op it = VEC_GET(current->vm.prog, i);
+        if (!is_intrinsic(it, W_INCLUDE))
+            continue;
+        IncludeJob job = {.path = current->vm.mem + VEC_GET(current->vm.prog, i - 1).op};
+        // A missing file fails in compile_front like any other.
+        if (realpath(job.path, job.real) == NULL)
+            snprintf(job.real, sizeof(job.real), "%s", job.path);
+        bool seen = is_included(current, job.real);
+        for (int j = 0; j < jobs.cnt && !seen; j++)
+            seen = strcmp(VEC_GET(jobs, j).real, job.real) == 0;
+        if (!seen)
+            VEC_ADD(&jobs, job);
+    }
+
+    IncludePool pool = {jobs.data, jobs.cnt, 0, current, run_out(), 0};
+    int extra = claim_include_threads(jobs.cnt - 1);
+    pthread_t *threads = malloc(sizeof(pthread_t) * (extra > 0 ? extra : 1));
+    int started = 0;
+    for (; started < extra; started++) {
+        if (pthread_create(&threads[started], NULL, include_worker, &pool) != 0)
+            break;
+    }
+    release_include_threads(extra - started);
+    include_worker(&pool);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    release_include_threads(started);
+    free(threads);
+    if (pool.status != 0) {
+        FOR_LIST(jobs) {
+            // A job that failed or never ran has no module.
+            if (VEC_GET(jobs, i).owned && VEC_GET(jobs, i).m != NULL)
+                free_module(VEC_GET(jobs, i).m);
+        }
+        VEC_FREE(jobs);
+        free(dead);
+        fail(pool.status);
+    }
+
+    FOR_LIST(jobs) {
+        IncludeJob job = VEC_GET(jobs, i);
+        if (!is_included(current, job.real))
+            merge_module(current, job.m);
+        if (job.owned)
+            free_module(job.m);
+    }
+    VEC_FREE(jobs);
+
+    // path 'include'
+    for (int i = 1; i < current->vm.prog.cnt; i++) {
+        if (is_intrinsic(VEC_GET(current->vm.prog, i), W_INCLUDE))
+            dead[i] = dead[i - 1] = true;
+    }
+    compact_program(&current->vm.prog, dead);
+    free(dead);
+}
+// ;modules
+
+// :gen
+// x86-64 backend for `gen`: emits GNU assembly for the linked program and
+// links it with the system `cc`. Register use inside `main`:
+//   r12 data stack pointer, r13 back stack pointer, r14 vm.mem,
+//   rbx data stack base, r15 data stack slot that overflows, rbp scratch.
+// Checks are only emitted for programs the verifier could not prove, every
+// failing check jumps to a cold stub printing what error() would print.
+typedef struct {
+    char *text; // everything known at compile time
+    const char *fmt; // prints the runtime values, passed in rdx and rcx
+} GenError;
+List(GenErrors, GenError);
+
+typedef struct {
+    FILE *out;
+    ProgramRun *prog;
+    bool checked;
+    GenErrors errors;
+} Gen;
+
+// Quoted with the escapes GNU as and C share.
+void write_quoted(FILE *out, const char *str, size_t len) {
+    fputc('"', out);
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (isprint(c))
+            fputc(c, out);
+        else
+            fprintf(out, "\\%03o", c);
+    }
+    fputc('"', out);
+}
+
+void gen_string(FILE *out, const char *str, size_t len) {
+    fprintf(out, "    .string ");
+    write_quoted(out, str, len);
+    fprintf(out, "\n");
+}
+
+// Returns the label of a new error stub, `fmt` formats the values the site
+// loads into rdx and rcx.
+int gen_error(Gen *g, ErrorType type, Op o, const char *fmt, const char *msg, ...) {
+    char text[PATH_MAX + 512];
+    int n = error_prefix(text, sizeof(text), type, o);
+
+    va_list list;
+    va_start(list, msg);
+    vsnprintf(text + n, sizeof(text) - n, msg, list);
+    va_end(list);
+
+    GenError e = {strdup(text), fmt};
+    VEC_ADD(&g->errors, e);
+    return g->errors.cnt - 1;
+}
+
+void gen_need(Gen *g, Op o, int amount) {
+    if (!g->checked)
+        return;
+    int err = gen_error(g, ERR_UNDERFLOW, o, "", "`%s` requires at least %d value(s) on the stack.\n", op_to_syntax(o), amount);
+    fprintf(g->out, "    leaq -%d(%%r12), %%rax\n", 8 * amount);
+    fprintf(g->out, "    cmpq %%rbx, %%rax\n");
+    fprintf(g->out, "    jb .Lerr%d\n", err);
+}
+
+// Checks the push into `slot` above the top fits.
+void gen_room(Gen *g, Op o, int slot) {
+    if (!g->checked)
+        return;
+    int err = gen_error(g, ERR_OVERFLOW, o, "", "`%s` can't push more value(s).\n", op_to_syntax(o));
+    fprintf(g->out, "    leaq %d(%%r12), %%rax\n", 8 * slot);
+    fprintf(g->out, "    cmpq %%r15, %%rax\n");
+    fprintf(g->out, "    jae .Lerr%d\n", err);
+}
+
+void gen_push_imm(Gen *g, Op o, long val) {
+    if (g->checked) {
+        int err = gen_error(g, ERR_OVERFLOW, o, "", "Can't push literal number %d\n", val);
+        fprintf(g->out, "    cmpq %%r15, %%r12\n");
+        fprintf(g->out, "    jae .Lerr%d\n", err);
+    }
+    if (val >= INT_MIN && val <= INT_MAX) {
+        fprintf(g->out, "    movq $%ld, (%%r12)\n", val);
+    } else {
+        fprintf(g->out, "    movabsq $%ld, %%rax\n", val);
+        fprintf(g->out, "    movq %%rax, (%%r12)\n");
+    }
+    fprintf(g->out, "    addq $8, %%r12\n");
+}
+
+// eax = top, ecx = ut, leaves `top op ut` in rax.
+void gen_binop_eval(FILE *out, BinopType type) {
+    static_assert(BT_COUNT == 8, "Implement newly added BinopType");
+    switch (type) {
+    case BT_PLUS:
+        fprintf(out, "    addl %%ecx, %%eax\n");
+        break;
+    case BT_MINUS:
+        fprintf(out, "    subl %%ecx, %%eax\n");
+        break;
+    case BT_MULT:
+        fprintf(out, "    imull %%ecx, %%eax\n");
+        break;
+    case BT_DIV:
+        fprintf(out, "    cltd\n    idivl %%ecx\n");
+        break;
+    case BT_MOD:
+        fprintf(out, "    cltd\n    idivl %%ecx\n    movl %%edx, %%eax\n");
+        break;
+    case BT_LT:
+        fprintf(out, "    cmpl %%ecx, %%eax\n    setl %%al\n    movzbl %%al, %%eax\n");
+        return;
+    case BT_GT:
+        fprintf(out, "    cmpl %%ecx, %%eax\n    setg %%al\n    movzbl %%al, %%eax\n");
+        return;
+    case BT_EQ:
+        fprintf(out, "    cmpl %%ecx, %%eax\n    sete %%al\n    movzbl %%al, %%eax\n");
+        return;
+    default:
+        assert(false && "unreachable");
+    }
+    fprintf(out, "    cltq\n");
+}
+
+void gen_printf(FILE *out, const char *fmt_label) {
+    fprintf(out, "    leaq %s(%%rip), %%rdi\n", fmt_label);
+    fprintf(out, "    xorl %%eax, %%eax\n");
+    fprintf(out, "    call printf@PLT\n");
+}
+
+// Prints `count` slots of `base` from index 0, like dump_stack.
+void gen_dump(FILE *out, const char *base, const char *head, const char *foot) {
+    gen_printf(out, head);
+    fprintf(out, "    xorl %%ebp, %%ebp\n");
+    fprintf(out, "1:\n");
+    fprintf(out, "    movq %%r12, %%rax\n");
+    fprintf(out, "    subq %%rbx, %%rax\n");
+    fprintf(out, "    sarq $3, %%rax\n");
+    fprintf(out, "    cmpq %%rax, %%rbp\n");
+    fprintf(out, "    jge 2f\n");
+    fprintf(out, "    leaq %s(%%rip), %%rax\n", base);
+    fprintf(out, "    movq (%%rax,%%rbp,8), %%rdx\n");
+    fprintf(out, "    movl %%ebp, %%esi\n");
+    gen_printf(out, ".Lfmt_slot");
+    fprintf(out, "    incq %%rbp\n");
+    fprintf(out, "    jmp 1b\n");
+    fprintf(out, "2:\n");
+    gen_printf(out, foot);
+}
+
+// Moves `n` values between the stacks like interpet_stash and interpet_pop,
+// `from`/`to` are the stack pointer registers.
+void gen_transfer(Gen *g, Op o, bool stash) {
+    FILE *out = g->out;
+    const char *from = stash ? "%r12" : "%r13";
+    const char *to = stash ? "%r13" : "%r12";
+
+    gen_need(g, o, 1);
+    fprintf(out, "    subq $8, %%r12\n");
+    fprintf(out, "    movq (%%r12), %%rdx\n");
+    if (g->checked) {
+        // rcx = sp, rsi = bsp
+        fprintf(out, "    movq %%r12, %%rcx\n");
+        fprintf(out, "    subq %%rbx, %%rcx\n");
+        fprintf(out, "    sarq $3, %%rcx\n");
+        fprintf(out, "    leaq concat_bstack(%%rip), %%rax\n");
+        fprintf(out, "    movq %%r13, %%rsi\n");
+        fprintf(out, "    subq %%rax, %%rsi\n");
+        fprintf(out, "    sarq $3, %%rsi\n");
+        int under, over;
+        if (stash) {
+            under = gen_error(g, ERR_UNDERFLOW, o, "Trying to stash %d values on the stack, but only %d are available.\n", "");
+            over = gen_error(g, ERR_BACK_OVERFLOW, o, "Can't stash %d values on back stack.\n", "");
+            fprintf(out, "    cmpq %%rdx, %%rcx\n");
+            fprintf(out, "    jl .Lerr%d\n", under);
+            fprintf(out, "    addq %%rdx, %%rsi\n");
+            fprintf(out, "    cmpq $%d, %%rsi\n", backstack_size);
+            fprintf(out, "    jge .Lerr%d\n", over);
+        } else {
+            under = gen_error(g, ERR_UNDERFLOW, o, "Trying to pop %d values from the back stack, but only %d are available.\n", "");
+            over = gen_error(g, ERR_OVERFLOW, o, "Can't pop %d values on stack.\n", "");
+            fprintf(out, "    cmpq %%rdx, %%rsi\n");
+            fprintf(out, "    jl .Lerr%d\n", under);
+            fprintf(out, "    leaq (%%rcx,%%rdx), %%rsi\n");
+            fprintf(out, "    cmpq $%d, %%rsi\n", stack_size);
+            fprintf(out, "    jge .Lerr%d\n", over);
+        }
+    }
+    fprintf(out, "    testq %%rdx, %%rdx\n");
+    fprintf(out, "    jle 2f\n");
+    fprintf(out, "1:\n");
+    fprintf(out, "    subq $8, %s\n", from);
+    fprintf(out, "    movq (%s), %%rax\n", from);
+    fprintf(out, "    movq %%rax, (%s)\n", to);
+    fprintf(out, "    addq $8, %s\n", to);
+    fprintf(out, "    decq %%rdx\n");
+    fprintf(out, "    jnz 1b\n");
+    fprintf(out, "2:\n");
+}
+
+void gen_libc_call(Gen *g, Op o) {
+    FILE *out = g->out;
+    static const char *regs[LIBC_MAX_ARITY] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+    LibcFunc f = libc_funcs[o.op];
+    // The VM allocator isn't linked in, blocks come from malloc and stay
+    // until they are freed.
+    if (f.call == libc_arena_reset)
+        return;
+
+    gen_need(g, o, f.arity);
+    for (int i = 0; i < f.arity; i++)
+        fprintf(out, "    movq -%d(%%r12), %s\n", 8 * (i + 1), regs[i]);
+    if (f.arity > 0)
+        fprintf(out, "    subq $%d, %%r12\n", 8 * f.arity);
+    // Mirror the argument conversions of the libc_* wrappers.
+    if (f.call == libc_open)
+        fprintf(out, "    addq %%r14, %%rdi\n");
+    else if (f.call == libc_malloc)
+        fprintf(out, "    movslq %%edi, %%rdi\n");
+    fprintf(out, "    xorl %%eax, %%eax\n");
+    fprintf(out, "    call %s@PLT\n", f.name);
+    if (f.returns) {
+        fprintf(out, "    movq %%rax, (%%r12)\n");
+        fprintf(out, "    addq $8, %%r12\n");
+    }
+}
+
+// Pushes `size` bytes at `addr` in vm.mem, like `deref`. The value is loaded
+// into the free slot first so the overflow check can report it.
+void gen_load(Gen *g, Op o, int size, long addr) {
+    FILE *out = g->out;
+    switch (size) {
+    case 1:
+        fprintf(out, "    movzbl %ld(%%r14), %%eax\n", addr);
+        break;
+    case 2:
+        fprintf(out, "    movzwl %ld(%%r14), %%eax\n", addr);
+        break;
+    case 4:
+        fprintf(out, "    movl %ld(%%r14), %%eax\n", addr);
+        break;
+    case 8:
+        fprintf(out, "    movq %ld(%%r14), %%rax\n", addr);
+        break;
+    default:
+        fprintf(out, "    movq $0, (%%r12)\n");
+        fprintf(out, "    movq %%r12, %%rdi\n");
+        fprintf(out, "    leaq %ld(%%r14), %%rsi\n", addr);
+        fprintf(out, "    movq $%d, %%rdx\n", size);
+        fprintf(out, "    call memcpy@PLT\n");
+        fprintf(out, "    movq (%%r12), %%rax\n");
+        break;
+    }
+    fprintf(out, "    movq %%rax, %%rdx\n");
+    gen_room(g, o, 0);
+    fprintf(out, "    movq %%rdx, (%%r12)\n");
+    fprintf(out, "    addq $8, %%r12\n");
+}
+
+void gen_intrinsic(Gen *g, Op o) {
+    FILE *out = g->out;
+    static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
+    switch (o.op) {
+    case W_PUTD: {
+        gen_need(g, o, 1);
+        fprintf(out, "    subq $8, %%r12\n");
+        fprintf(out, "    movq (%%r12), %%rsi\n");
+        gen_printf(out, ".Lfmt_ld");
+    } break;
+    case W_PUTC: {
+        gen_need(g, o, 1);
+        fprintf(out, "    subq $8, %%r12\n");
+        fprintf(out, "    movl (%%r12), %%esi\n");
+        gen_printf(out, ".Lfmt_c");
+    } break;
+    case W_PRINT:
+    case W_PRINTLN: {
+        gen_need(g, o, 1);
+        fprintf(out, "    subq $8, %%r12\n");
+        fprintf(out, "    movq (%%r12), %%rsi\n");
+        fprintf(out, "    addq %%r14, %%rsi\n");
+        gen_printf(out, o.op == W_PRINT ? ".Lfmt_s" : ".Lfmt_sn");
+    } break;
+    case W_LOOP:
+    case W_ENDIF:
+        break;
+    case W_END:
+    case W_ELSE: {
+        fprintf(out, "    jmp .Lop%d\n", o.link);
+    } break;
+    case W_DO:
+    case W_IF: {
+        gen_need(g, o, 1);
+        fprintf(out, "    subq $8, %%r12\n");
+        fprintf(out, "    cmpq $0, (%%r12)\n");
+        fprintf(out, "    je .Lop%d\n", o.link);
+    } break;
+    case W_W_MEM:
+    case W_W_MEM64: {
+        gen_need(g, o, 2);
+        fprintf(out, "    subq $16, %%r12\n");
+        fprintf(out, "    movq 8(%%r12), %%rax\n");
+        fprintf(out, "    movq (%%r12), %%rcx\n");
+        fprintf(out, "    movq %%rcx, (%%r14,%%rax)\n");
+    } break;
+    case W_DEREF: {
+        // The loaded value lands in the slot of the size.
+        gen_need(g, o, 2);
+        fprintf(out, "    movq -16(%%r12), %%rdx\n");
+        fprintf(out, "    movq -8(%%r12), %%rsi\n");
+        fprintf(out, "    addq %%r14, %%rsi\n");
+        fprintf(out, "    leaq -16(%%r12), %%rdi\n");
+        fprintf(out, "    movq $0, (%%rdi)\n");
+        fprintf(out, "    call memcpy@PLT\n");
+        fprintf(out, "    subq $8, %%r12\n");
+    } break;
+    case W_AS_STR: {
+        gen_need(g, o, 2);
+        int err = gen_error(g, ERR_OUT_OF_MEMORY, o, "`as_str` can't copy %d bytes.\n", "");
+        fprintf(out, "    movq -16(%%r12), %%rdx\n");
+        fprintf(out, "    movq concat_mem_ptr(%%rip), %%rdi\n");
+        fprintf(out, "    leaq 1(%%rdi,%%rdx), %%rax\n");
+        fprintf(out, "    cmpq $%zu, %%rax\n", heap_size);
+        fprintf(out, "    ja .Lerr%d\n", err);
+        fprintf(out, "    movq %%rax, concat_mem_ptr(%%rip)\n");
+        fprintf(out, "    movq %%rdi, -16(%%r12)\n");
+        fprintf(out, "    movq -8(%%r12), %%rsi\n");
+        fprintf(out, "    subq $8, %%r12\n");
+        fprintf(out, "    addq %%r14, %%rdi\n");
+        fprintf(out, "    leaq (%%rdi,%%rdx), %%rbp\n");
+        fprintf(out, "    call memcpy@PLT\n");
+        fprintf(out, "    movb $0, (%%rbp)\n");
+    } break;
+    default:
+        printf("Word not handled %s %s\n", op_to_str(o), TOKEN_LIT(*g->prog, o.index));
+        exit(1);
+    }
+}
+
+void gen_op(Gen *g, Op o) {
+    FILE *out = g->out;
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
+    switch (o.t) {
+    case OP_BINOP: {
+        gen_need(g, o, 2);
+        fprintf(out, "    movl -8(%%r12), %%eax\n");
+        fprintf(out, "    movl -16(%%r12), %%ecx\n");
+        gen_binop_eval(out, o.op);
+        fprintf(out, "    movq %%rax, -16(%%r12)\n");
+        fprintf(out, "    subq $8, %%r12\n");
+    } break;
+    case OP_LIT_NUMBER:
+    case OP_LIT_STR: {
+        gen_push_imm(g, o, o.op);
+    } break;
+    case OP_INTRINSIC: {
+        gen_intrinsic(g, o);
+    } break;
+    case OP_DUMP: {
+        gen_dump(out, "concat_stack", ".Lfmt_dump", ".Lfmt_dump_end");
+    } break;
+    case OP_BDUMP: {
+        gen_dump(out, "concat_bstack", ".Lfmt_bdump", ".Lfmt_bdump_end");
+    } break;
+    case OP_DUP: {
+        gen_need(g, o, 1);
+        fprintf(out, "    movq -8(%%r12), %%rdx\n");
+        gen_room(g, o, 0);
+        fprintf(out, "    movq %%rdx, (%%r12)\n");
+        fprintf(out, "    addq $8, %%r12\n");
+    } break;
+    case OP_2DUP: {
+        gen_need(g, o, 2);
+        fprintf(out, "    movq -16(%%r12), %%rdx\n");
+        gen_room(g, o, 0);
+        fprintf(out, "    movq -8(%%r12), %%rdx\n");
+        gen_room(g, o, 1);
+        fprintf(out, "    movq -16(%%r12), %%rax\n");
+        fprintf(out, "    movq %%rax, (%%r12)\n");
+        fprintf(out, "    movq %%rdx, 8(%%r12)\n");
+        fprintf(out, "    addq $16, %%r12\n");
+    } break;
+    case OP_DROP: {
+        gen_need(g, o, 1);
+        fprintf(out, "    subq $8, %%r12\n");
+    } break;
+    case OP_SWAP: {
+        gen_need(g, o, 2);
+        fprintf(out, "    movq -8(%%r12), %%rax\n");
+        fprintf(out, "    movq -16(%%r12), %%rcx\n");
+        fprintf(out, "    movq %%rcx, -8(%%r12)\n");
+        fprintf(out, "    movq %%rax, -16(%%r12)\n");
+    } break;
+    case OP_STASH:
+    case OP_POP: {
+        gen_transfer(g, o, o.t == OP_STASH);
+    } break;
+    case OP_LIBC: {
+        gen_libc_call(g, o);
+    } break;
+    case OP_LOAD: {
+        gen_load(g, o, o.sub, o.op);
+    } break;
+    case OP_STORE: {
+        gen_need(g, o, 1);
+        fprintf(out, "    subq $8, %%r12\n");
+        fprintf(out, "    movq (%%r12), %%rax\n");
+        fprintf(out, "    movq %%rax, %ld(%%r14)\n", o.op);
+    } break;
+    case OP_BINOP_IMM: {
+        gen_need(g, o, 1);
+        fprintf(out, "    movl $%d, %%eax\n", (int)o.op);
+        fprintf(out, "    movl -8(%%r12), %%ecx\n");
+        gen_binop_eval(out, o.sub);
+        fprintf(out, "    movq %%rax, -8(%%r12)\n");
+    } break;
+    case OP_CMP_DO: {
+        gen_need(g, o, 1);
+        // Comparisons branch on the flags, `imm op top` fails on the inverse.
+        const char *exit_jump[BT_COUNT] = {[BT_LT] = "jle", [BT_GT] = "jge", [BT_EQ] = "jne"};
+        if (exit_jump[o.sub] != NULL) {
+            fprintf(out, "    cmpl $%d, -8(%%r12)\n", (int)o.op);
+            fprintf(out, "    %s .Lop%d\n", exit_jump[o.sub], o.link);
+            break;
+        }
+        fprintf(out, "    movl $%d, %%eax\n", (int)o.op);
+        fprintf(out, "    movl -8(%%r12), %%ecx\n");
+        gen_binop_eval(out, o.sub);
+        fprintf(out, "    testl %%eax, %%eax\n");
+        fprintf(out, "    je .Lop%d\n", o.link);
+    } break;
+    case OP_PUTD_CHAR: {
+        gen_need(g, o, 1);
+        fprintf(out, "    subq $8, %%r12\n");
+        fprintf(out, "    movq (%%r12), %%rsi\n");
+        fprintf(out, "    movl $%d, %%edx\n", (int)o.op);
+        gen_printf(out, ".Lfmt_ldc");
+    } break;
+    default:
+        break;
+    }
+}
+
+void gen_data(Gen *g) {
+    FILE *out = g->out;
+    VM *vm = &g->prog->vm;
+
+    fprintf(out, "    .bss\n");
+    fprintf(out, "    .align 16\n");
+    fprintf(out, "concat_stack:\n    .zero %d\n", 8 * stack_size);
+    fprintf(out, "concat_bstack:\n    .zero %d\n", 8 * backstack_slots());
+    fprintf(out, "    .align 16\n");
+    fprintf(out, "concat_mem:\n    .zero %zu\n", heap_size);
+
+    fprintf(out, "    .data\n");
+    fprintf(out, "    .align 8\n");
+    fprintf(out, "concat_mem_ptr:\n    .quad %zu\n", vm->mem_ptr);
+    // Copied into concat_mem on start so the heap stays in .bss.
+    fprintf(out, "concat_mem_init:\n");
+    size_t init = mem_init_len(vm);
+    for (size_t i = 0; i < init; i += 16) {
+        fprintf(out, "    .byte ");
+        for (size_t j = i; j < i + 16 && j < init; j++)
+            fprintf(out, j == i ? "%d" : ",%d", (unsigned char)vm->mem[j]);
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "    .section .rodata\n");
+    const char *fmts[][2] = {
+        {".Lfmt_ld", "%ld"},
+        {".Lfmt_c", "%c"},
+        {".Lfmt_s", "%s"},
+        {".Lfmt_sn", "%s\n"},
+        {".Lfmt_ldc", "%ld%c"},
+        {".Lfmt_slot", "[%d] %ld\n"},
+        {".Lfmt_dump", "> Stack Dump:\n"},
+        {".Lfmt_dump_end", "< End Stack Dump.\n"},
+        {".Lfmt_bdump", "> Back Stack Dump:\n"},
+        {".Lfmt_bdump_end", "< End Back Stack Dump.\n"},
+        {".Lfmt_unhandled", "E: Unhandled data on the stack.\n"},
+    };
+    for (size_t i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+        fprintf(out, "%s:\n", fmts[i][0]);
+        gen_string(out, fmts[i][1], strlen(fmts[i][1]));
+    }
+    FOR_LIST(g->errors) {
+        GenError e = VEC_GET(g->errors, i);
+        fprintf(out, ".Lerr_text%d:\n", i);
+        gen_string(out, e.text, strlen(e.text));
+        fprintf(out, ".Lerr_fmt%d:\n", i);
+        char fmt[128];
+        snprintf(fmt, sizeof(fmt), "%%s%s", e.fmt);
+        gen_string(out, fmt, strlen(fmt));
+    }
+    fprintf(out, "    .section .note.GNU-stack,\"\",@progbits\n");
+}
+
+bool gen_asm(ProgramRun *prog, FILE *out) {
+    Gen g = {out, prog, !prog->verified, {0}};
+    Program p = prog->vm.prog;
+
+    fprintf(out, "    .text\n");
+    fprintf(out, "    .globl main\n");
+    fprintf(out, "    .type main, @function\n");
+    fprintf(out, "main:\n");
+    const char *saved[] = {"%rbp", "%rbx", "%r12", "%r13", "%r14", "%r15"};
+    for (int i = 0; i < 6; i++)
+        fprintf(out, "    pushq %s\n", saved[i]);
+    // Six pushes and the return address, realign for calls.
+    fprintf(out, "    subq $8, %%rsp\n");
+    if (mem_init_len(&prog->vm) > 0) {
+        fprintf(out, "    leaq concat_mem(%%rip), %%rdi\n");
+        fprintf(out, "    leaq concat_mem_init(%%rip), %%rsi\n");
+        fprintf(out, "    movq $%zu, %%rdx\n", mem_init_len(&prog->vm));
+        fprintf(out, "    call memcpy@PLT\n");
+    }
+    fprintf(out, "    leaq concat_stack(%%rip), %%rbx\n");
+    fprintf(out, "    leaq %d(%%rbx), %%r15\n", 8 * (stack_size - 1));
+    fprintf(out, "    movq %%rbx, %%r12\n");
+    fprintf(out, "    leaq concat_bstack(%%rip), %%r13\n");
+    fprintf(out, "    leaq concat_mem(%%rip), %%r14\n");
+
+    for (int ip = 0; ip < p.cnt; ip++) {
+        Op o = VEC_GET(p, ip);
+        fprintf(out, ".Lop%d:\n", ip);
+        if (o.t == OP_NOP)
+            break;
+        gen_op(&g, o);
+    }
+
+    // check_unhandled_data
+    fprintf(out, "    cmpq %%rbx, %%r12\n");
+    fprintf(out, "    je 3f\n");
+    gen_printf(out, ".Lfmt_unhandled");
+    fprintf(out, "    movq %%r12, %%rbp\n");
+    fprintf(out, "1:\n");
+    fprintf(out, "    cmpq %%rbx, %%rbp\n");
+    fprintf(out, "    je 3f\n");
+    fprintf(out, "    subq $8, %%rbp\n");
+    fprintf(out, "    movq (%%rbp), %%rdx\n");
+    fprintf(out, "    movq %%rbp, %%rsi\n");
+    fprintf(out, "    subq %%rbx, %%rsi\n");
+    fprintf(out, "    sarq $3, %%rsi\n");
+    gen_printf(out, ".Lfmt_slot");
+    fprintf(out, "    jmp 1b\n");
+    fprintf(out, "3:\n");
+    fprintf(out, "    xorl %%eax, %%eax\n");
+    fprintf(out, "    addq $8, %%rsp\n");
+    for (int i = 5; i >= 0; i--)
+        fprintf(out, "    popq %s\n", saved[i]);
+    fprintf(out, "    ret\n");
+
+    FOR_LIST(g.errors) {
+        fprintf(out, ".Lerr%d:\n", i);
+        fprintf(out, "    leaq .Lerr_text%d(%%rip), %%rsi\n", i);
+        char label[32];
+        snprintf(label, sizeof(label), ".Lerr_fmt%d", i);
+        gen_printf(out, label);
+        fprintf(out, "    movl $1, %%edi\n");
+        fprintf(out, "    call exit@PLT\n");
+    }
+
+    gen_data(&g);
+
+    FOR_LIST(g.errors) {
+        free(VEC_GET(g.errors, i).text);
+    }
+    VEC_FREE(g.errors);
+    return ferror(out) == 0;
+}
+
+// Writes `<exe>.s` and links it into `exe`.
+bool gen_program(ProgramRun *prog, const char *exe) {
+    char asm_path[PATH_MAX];
+    snprintf(asm_path, sizeof(asm_path), "%s.s", exe);
+
+    FILE *out = fopen(asm_path, "w");
+    if (out == NULL) {
+        printf("Can't open %s for writing.\n", asm_path);
+        return false;
+    }
+    bool ok = gen_asm(prog, out);
+    ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        printf("Failed to write %s.\n", asm_path);
+        return false;
+    }
+
+    char cmd[2 * PATH_MAX + 32];
+    snprintf(cmd, sizeof(cmd), "cc -o '%s' '%s'", exe, asm_path);
+    if (system(cmd) != 0) {
+        printf("Failed to assemble %s.\n", asm_path);
+        return false;
+    }
+    return true;
+}
+// ;gen
+
+// :emitc
+// C backend for `emit-c`: one translation unit with an op per statement and
+// gotos for the links. Proven programs know the depth before every op, so
+// each stack slot becomes a local (`sN`, `bN` for the back stack) the C
+// compiler can keep in registers. Others index arrays and keep every check.
+typedef struct {
+    FILE *out;
+    ProgramRun *prog;
+    StackState *states; // NULL when the program is not proven
+    StackState s; // depths before the current op
+    char names[4][32];
+    int name;
+} EmitC;
+
+// Slot `off` relative to the top before the op, -1 is the top.
+const char *emitc_slot(EmitC *e, int off) {
+    char *buf = e->names[e->name++ % 4];
+    if (e->states != NULL)
+        snprintf(buf, sizeof(e->names[0]), "s%d", e->s.depth + off);
+    else if (off < 0)
+        snprintf(buf, sizeof(e->names[0]), "stack[sp - %d]", -off);
+    else if (off == 0)
+        snprintf(buf, sizeof(e->names[0]), "stack[sp]");
+    else
+        snprintf(buf, sizeof(e->names[0]), "stack[sp + %d]", off);
+    return buf;
+}
+
+void emitc_sp(EmitC *e, int delta) {
+    if (e->states == NULL && delta != 0)
+        fprintf(e->out, "    sp += %d;\n", delta);
+}
+
+// Calls fail() with what error() would print, `fmt` formats `a` and `b`.
+void emitc_fail(EmitC *e, const char *a, const char *b, ErrorType type, Op o, const char *fmt, const char *msg, ...) {
+    char text[PATH_MAX + 512];
+    int n = error_prefix(text, sizeof(text), type, o);
+
+    va_list list;
+    va_start(list, msg);
+    vsnprintf(text + n, sizeof(text) - n, msg, list);
+    va_end(list);
+
+    fprintf(e->out, "fail(");
+    write_quoted(e->out, text, strlen(text));
+    fprintf(e->out, ", ");
+    write_quoted(e->out, fmt, strlen(fmt));
+    fprintf(e->out, ", %s, %s);\n", a, b);
+}
+
+void emitc_need(EmitC *e, Op o, int amount) {
+    if (e->states != NULL)
+        return;
+    fprintf(e->out, "    if (sp < %d)\n        ", amount);
+    emitc_fail(e, "0", "0", ERR_UNDERFLOW, o, "", "`%s` requires at least %d value(s) on the stack.\n", op_to_syntax(o), amount);
+}
+
+// Checks the push into `off` fits.
+void emitc_room(EmitC *e, Op o, int off) {
+    if (e->states != NULL)
+        return;
+    fprintf(e->out, "    if (sp + %d >= %d)\n        ", off + 1, stack_size);
+    emitc_fail(e, "0", "0", ERR_OVERFLOW, o, "", "`%s` can't push more value(s).\n", op_to_syntax(o));
+}
+
+void emitc_binop(EmitC *e, BinopType type, const char *dst, const char *top, const char *ut) {
+    static_assert(BT_COUNT == 8, "Implement newly added BinopType");
+    const char *ops[BT_COUNT] = {
+        [BT_PLUS] = "+",
+        [BT_MINUS] = "-",
+        [BT_MULT] = "*",
+        [BT_DIV] = "/",
+        [BT_MOD] = "%",
+        [BT_LT] = "<",
+        [BT_GT] = ">",
+        [BT_EQ] = "==",
+    };
+    // Wraps around at 32 bits like the interpreters, see WRAP.
+    if (type == BT_PLUS || type == BT_MINUS || type == BT_MULT)
+        fprintf(e->out, "    %s = (int)((unsigned)%s %s (unsigned)%s);\n", dst, top, ops[type], ut);
+    else
+        fprintf(e->out, "    %s = (int)%s %s (int)%s;\n", dst, top, ops[type], ut);
+}
+
+// Prints `n` slots of `stack` like dump_stack, `n` is the data stack depth.
+void emitc_dump(EmitC *e, char stack, const char *head, const char *foot) {
+    FILE *out = e->out;
+    fprintf(out, "    printf(\"%s\\n\");\n", head);
+    if (e->states != NULL) {
+        for (int j = 0; j < e->s.depth; j++)
+            fprintf(out, "    printf(\"[%%d] %%ld\\n\", %d, %c%d);\n", j, stack, j);
+    } else {
+        fprintf(out, "    for (int j = 0; j < sp; j++)\n");
+        fprintf(out, "        printf(\"[%%d] %%ld\\n\", j, %s[j]);\n", stack == 's' ? "stack" : "backStack");
+    }
+    fprintf(out, "    printf(\"%s\\n\");\n", foot);
+}
+
+// `<-` and `->`, the count is on top.
+void emitc_transfer(EmitC *e, Op o, int ip, bool stash) {
+    FILE *out = e->out;
+    if (e->states != NULL) {
+        long n = verify_count(e->prog->vm.prog, e->prog->cfg.is_target, ip);
+        int d = e->s.depth - 1, bd = e->s.bdepth;
+        for (int k = 0; k < n; k++) {
+            if (stash)
+                fprintf(out, "    b%d = s%d;\n", bd + k, d - 1 - k);
+            else
+                fprintf(out, "    s%d = b%d;\n", d + k, bd - 1 - k);
+        }
+        return;
+    }
+
+    emitc_need(e, o, 1);
+    fprintf(out, "    {\n");
+    fprintf(out, "    long n = stack[--sp];\n");
+    if (stash) {
+        fprintf(out, "    if (sp - n < 0)\n        ");
+        emitc_fail(e, "n", "sp", ERR_UNDERFLOW, o, "Trying to stash %d values on the stack, but only %d are available.\n", "");
+        fprintf(out, "    if (bsp + n >= %d)\n        ", backstack_size);
+        emitc_fail(e, "n", "0", ERR_BACK_OVERFLOW, o, "Can't stash %d values on back stack.\n", "");
+        fprintf(out, "    for (int k = 0; k < n; k++)\n");
+        fprintf(out, "        backStack[bsp++] = stack[--sp];\n");
+    } else {
+        fprintf(out, "    if (bsp - n < 0)\n        ");
+        emitc_fail(e, "n", "sp", ERR_UNDERFLOW, o, "Trying to pop %d values from the back stack, but only %d are available.\n", "");
+        fprintf(out, "    if (sp + n >= %d)\n        ", stack_size);
+        emitc_fail(e, "n", "0", ERR_OVERFLOW, o, "Can't pop %d values on stack.\n", "");
+        fprintf(out, "    for (int k = 0; k < n; k++)\n");
+        fprintf(out, "        stack[sp++] = backStack[--bsp];\n");
+    }
+    fprintf(out, "    }\n");
+}
+
+void emitc_intrinsic(EmitC *e, Op o) {
+    FILE *out = e->out;
+    static_assert(W_COUNT == 18, "Implement newly added IntrinsicType");
+    switch (o.op) {
+    case W_PUTD:
+        emitc_need(e, o, 1);
+        fprintf(out, "    printf(\"%%ld\", %s);\n", emitc_slot(e, -1));
+        emitc_sp(e, -1);
+        break;
+    case W_PUTC:
+        emitc_need(e, o, 1);
+        fprintf(out, "    printf(\"%%c\", (int)%s);\n", emitc_slot(e, -1));
+        emitc_sp(e, -1);
+        break;
+    case W_PRINT:
+    case W_PRINTLN:
+        emitc_need(e, o, 1);
+        fprintf(out, "    printf(\"%%s%s\", mem + %s);\n", o.op == W_PRINTLN ? "\\n" : "", emitc_slot(e, -1));
+        emitc_sp(e, -1);
+        break;
+    case W_LOOP:
+    case W_ENDIF:
+        break;
+    case W_END:
+    case W_ELSE:
+        fprintf(out, "    goto op%d;\n", o.link);
+        break;
+    case W_DO:
+    case W_IF:
+        emitc_need(e, o, 1);
+        emitc_sp(e, -1);
+        fprintf(out, "    if (!%s)\n        goto op%d;\n", emitc_slot(e, e->states != NULL ? -1 : 0), o.link);
+        break;
+    case W_W_MEM:
+    case W_W_MEM64:
+        emitc_need(e, o, 2);
+        fprintf(out, "    memcpy(mem + %s, &%s, sizeof(long));\n", emitc_slot(e, -1), emitc_slot(e, -2));
+        emitc_sp(e, -2);
+        break;
+    case W_DEREF: {
+        emitc_need(e, o, 2);
+        const char *size = emitc_slot(e, -2);
+        fprintf(out, "    {\n    long at = 0;\n    memcpy(&at, mem + %s, %s);\n", emitc_slot(e, -1), size);
+        fprintf(out, "    %s = at;\n    }\n", size);
+        emitc_sp(e, -1);
+    } break;
+    case W_AS_STR: {
+        emitc_need(e, o, 2);
+        fprintf(out, "    {\n    long len = %s;\n", emitc_slot(e, -2));
+        fprintf(out, "    if ((size_t)mem_ptr + len + 1 > %zu)\n        ", heap_size);
+        emitc_fail(e, "len", "0", ERR_OUT_OF_MEMORY, o, "`as_str` can't copy %d bytes.\n", "");
+        fprintf(out, "    memcpy(mem + mem_ptr, (void *)%s, len);\n", emitc_slot(e, -1));
+        fprintf(out, "    mem[mem_ptr + len] = 0;\n");
+        fprintf(out, "    %s = mem_ptr;\n", emitc_slot(e, -2));
+        fprintf(out, "    mem_ptr += len + 1;\n    }\n");
+        emitc_sp(e, -1);
+    } break;
+    default:
+        printf("Word not handled %s %s\n", op_to_str(o), TOKEN_LIT(*e->prog, o.index));
+        exit(1);
+    }
+}
+
+void emitc_op(EmitC *e, Op o, int ip) {
+    FILE *out = e->out;
+    static_assert(OP_COUNT == 19, "Implement newly added OpType");
+    switch (o.t) {
+    case OP_BINOP: {
+        emitc_need(e, o, 2);
+        emitc_binop(e, o.op, emitc_slot(e, -2), emitc_slot(e, -1), emitc_slot(e, -2));
+        emitc_sp(e, -1);
+    } break;
+    case OP_LIT_NUMBER:
+    case OP_LIT_STR: {
+        if (e->states == NULL) {
+            fprintf(out, "    if (sp + 1 >= %d)\n        ", stack_size);
+            emitc_fail(e, "0", "0", ERR_OVERFLOW, o, "", "Can't push literal number %d\n", o.op);
+        }
+        fprintf(out, "    %s = %ldL;\n", emitc_slot(e, 0), o.op);
+        emitc_sp(e, 1);
+    } break;
+    case OP_INTRINSIC: {
+        emitc_intrinsic(e, o);
+    } break;
+    case OP_DUMP: {
+        emitc_dump(e, 's', "> Stack Dump:", "< End Stack Dump.");
+    } break;
+    case OP_BDUMP: {
+        emitc_dump(e, 'b', "> Back Stack Dump:", "< End Back Stack Dump.");
+    } break;
+    case OP_DUP: {
+        emitc_need(e, o, 1);
+        emitc_room(e, o, 0);
+        fprintf(out, "    %s = %s;\n", emitc_slot(e, 0), emitc_slot(e, -1));
+        emitc_sp(e, 1);
+    } break;
+    case OP_2DUP: {
+        emitc_need(e, o, 2);
+        emitc_room(e, o, 0);
+        emitc_room(e, o, 1);
+        fprintf(out, "    %s = %s;\n", emitc_slot(e, 0), emitc_slot(e, -2));
+        fprintf(out, "    %s = %s;\n", emitc_slot(e, 1), emitc_slot(e, -1));
+        emitc_sp(e, 2);
+    } break;
+    case OP_DROP: {
+        emitc_need(e, o, 1);
+        emitc_sp(e, -1);
+    } break;
+    case OP_SWAP: {
+        emitc_need(e, o, 2);
+        fprintf(out, "    {\n    long top = %s;\n", emitc_slot(e, -1));
+        fprintf(out, "    %s = %s;\n", emitc_slot(e, -1), emitc_slot(e, -2));
+        fprintf(out, "    %s = top;\n    }\n", emitc_slot(e, -2));
+    } break;
+    case OP_STASH:
+    case OP_POP: {
+        emitc_transfer(e, o, ip, o.t == OP_STASH);
+    } break;
+    case OP_LIBC: {
+        LibcFunc f = libc_funcs[o.op];
+        emitc_need(e, o, f.arity);
+        fprintf(out, "    {\n");
+        for (int i = 0; i < f.arity; i++)
+            fprintf(out, "    long a%d = %s;\n", i, emitc_slot(e, -1 - i));
+        fprintf(out, "    ");
+        if (f.returns)
+            fprintf(out, "%s = ", emitc_slot(e, -f.arity));
+        fprintf(out, "%s;\n    }\n", f.c_call);
+        emitc_sp(e, (f.returns ? 1 : 0) - f.arity);
+    } break;
+    case OP_LOAD: {
+        fprintf(out, "    {\n    long at = 0;\n    memcpy(&at, mem + %ld, %d);\n", o.op, o.sub);
+        emitc_room(e, o, 0);
+        fprintf(out, "    %s = at;\n    }\n", emitc_slot(e, 0));
+        emitc_sp(e, 1);
+    } break;
+    case OP_STORE: {
+        emitc_need(e, o, 1);
+        fprintf(out, "    memcpy(mem + %ld, &%s, sizeof(long));\n", o.op, emitc_slot(e, -1));
+        emitc_sp(e, -1);
+    } break;
+    case OP_BINOP_IMM: {
+        emitc_need(e, o, 1);
+        char imm[32];
+        snprintf(imm, sizeof(imm), "%d", (int)o.op);
+        emitc_binop(e, o.sub, emitc_slot(e, -1), imm, emitc_slot(e, -1));
+    } break;
+    case OP_CMP_DO: {
+        emitc_need(e, o, 1);
+        fprintf(out, "    {\n    long cond;\n");
+        char imm[32];
+        snprintf(imm, sizeof(imm), "%d", (int)o.op);
+        emitc_binop(e, o.sub, "cond", imm, emitc_slot(e, -1));
+        fprintf(out, "    if (!cond)\n        goto op%d;\n    }\n", o.link);
+    } break;
+    case OP_PUTD_CHAR: {
+        emitc_need(e, o, 1);
+        fprintf(out, "    printf(\"%%ld%%c\", %s, %d);\n", emitc_slot(e, -1), (int)o.op);
+        emitc_sp(e, -1);
+    } break;
+    default:
+        break;
+    }
+}
+
+bool emit_c(ProgramRun *prog, FILE *out) {
+    Program p = prog->vm.prog;
+    VM *vm = &prog->vm;
+    EmitC e = {.out = out, .prog = prog};
+    // The optimizer keeps stack effects, so this proves what was proven.
+    if (prog->verified && !verify_stack_states(prog, &e.states))
+        e.states = NULL;
+
+    fprintf(out, "// Generated by `main emit-c` from %s.\n", VEC_GET(prog->deps, 0).path);
+    fprintf(out, "#include <fcntl.h>\n#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n");
+    fprintf(out, "#include <sys/mman.h>\n#include <unistd.h>\n\n");
+
+    // Only the used part is initialized so the rest of the heap stays in .bss.
+    fprintf(out, "__attribute__((unused)) static char mem[%zu];\n", heap_size);
+    size_t init = mem_init_len(vm);
+    if (init > 0) {
+        fprintf(out, "static const char mem_init[%zu] = {", init);
+        for (size_t i = 0; i < init; i++)
+            fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", vm->mem[i]);
+        fprintf(out, "\n};\n");
+    }
+    fprintf(out, "__attribute__((unused)) static long mem_ptr = %zu;\n\n", vm->mem_ptr);
+
+    fprintf(out, "__attribute__((noreturn, cold, unused)) static void fail(const char *text, const char *fmt, int a, int b) {\n");
+    fprintf(out, "    printf(\"%%s\", text);\n    printf(fmt, a, b);\n    exit(1);\n}\n\n");
+
+    fprintf(out, "int main(void) {\n");
+    if (init > 0)
+        fprintf(out, "    memcpy(mem, mem_init, sizeof(mem_init));\n");
+    bool *is_target = prog->cfg.is_target;
+    if (e.states != NULL) {
+        int max = 0, bmax = 0;
+        FOR_LIST(p) {
+            StackState s = e.states[i];
+            max = s.depth > max ? s.depth : max;
+            bmax = s.bdepth > bmax ? s.bdepth : bmax;
+        }
+        // Dumps print up to the deepest data stack, also from the back stack.
+        bmax = max > bmax ? max : bmax;
+        for (int i = 0; i < max + 2; i++)
+            fprintf(out, "    __attribute__((unused)) long s%d = 0;\n", i);
+        for (int i = 0; i < bmax; i++)
+            fprintf(out, "    __attribute__((unused)) long b%d = 0;\n", i);
+    } else {
+        fprintf(out, "    long stack[%d] = {0};\n    int sp = 0;\n", stack_size);
+        fprintf(out, "    __attribute__((unused)) long backStack[%d] = {0};\n    int bsp = 0;\n", backstack_slots());
+    }
+
+    int end = p.cnt - 1;
+    for (int ip = 0; ip < p.cnt; ip++) {
+        Op o = VEC_GET(p, ip);
+        if (o.t == OP_NOP) {
+            end = ip;
+            break;
+        }
+        if (is_target[ip])
+            fprintf(out, "op%d: __attribute__((unused));\n", ip);
+        if (e.states != NULL) {
+            e.s = e.states[ip];
+            if (e.s.depth == UNREACHED)
+                continue;
+        }
+        emitc_op(&e, o, ip);
+    }
+    if (is_target[end])
+        fprintf(out, "op%d: __attribute__((unused));\n", end);
+
+    // check_unhandled_data
+    if (e.states == NULL) {
+        fprintf(out, "    if (sp != 0) {\n");
+        fprintf(out, "        printf(\"E: Unhandled data on the stack.\\n\");\n");
+        fprintf(out, "        for (int i = sp - 1; i >= 0; i--)\n");
+        fprintf(out, "            printf(\"[%%d] %%ld\\n\", i, stack[i]);\n    }\n");
+    } else if (e.states[end].depth > 0) {
+        fprintf(out, "    printf(\"E: Unhandled data on the stack.\\n\");\n");
+        for (int i = e.states[end].depth - 1; i >= 0; i--)
+            fprintf(out, "    printf(\"[%%d] %%ld\\n\", %d, s%d);\n", i, i);
+    }
+    fprintf(out, "    return 0;\n}\n");
+
+    free(e.states);
+    return ferror(out) == 0;
+}
+// ;emitc
+
+bool parse_engine(const char *name, Engine *engine) {
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            *engine = i;
+            return true;
+        }
+    }
+    printf("Unknown engine %s, expected one of:", name);
+    for (int i = 0; i < ENGINE_COUNT; i++)
+        printf(" %s", engine_names[i]);
+    printf("\n");
+    return false;
+}
+
+// Stack sizes count slots, the last one is the overflow so at least two.
+bool parse_stack_size(const char *arg, const char *flag, int *size) {
+    char *end;
+    long n = strtol(arg, &end, 10);
+    if (*arg == 0 || *end != 0 || n < 2 || n > MAX_STACK_SIZE) {
+        printf("%s expects a number of slots between 2 and %d, got %s\n", flag, MAX_STACK_SIZE, arg);
+        return false;
+    }
+    *size = n;
+    return true;
+}
+
+// Bytes, with an optional `k` or `m` suffix.
+bool parse_heap_size(const char *arg, size_t *size) {
+    char *end;
+    long n = strtol(arg, &end, 10);
+    long unit = 1;
+    if (*end == 'k' || *end == 'K') {
+        unit = KB;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        unit = MB;
+        end++;
+    }
+    if (*arg == 0 || *end != 0 || n < 1 || n > MAX_HEAP / unit) {
+        printf("--heap expects a size between 1 and %d bytes, like 64k or 256m, got %s\n", MAX_HEAP, arg);
+        return false;
+    }
+    *size = n * unit;
+    return true;
+}
+
+// `main bench-defines [n]`: compiles generated sources with n/4, n/2 and n
+// definitions, each followed by a use, so the time per definition shows
+// whether removing them stays linear.
+int bench_defines(int n) {
+    char path[] = "/tmp/concat-defines-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        printf("Can't create a temporary file for the benchmark.\n");
+        return 1;
+    }
+    close(fd);
+
+    for (int count = n / 4 > 0 ? n / 4 : 1; count <= n; count *= 2) {
+        FILE *f = fopen(path, "w");
+        for (int i = 0; i < count; i++)
+            fprintf(f, "%d c%d def c%d ,\n", i, i, i);
+        fclose(f);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ProgramRun run;
+        compile_program(path, (Options){0}, &run);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        printf("compile: %d definitions in %.1f ms, %.3f us each\n", count, ms, ms * 1e3 / count);
+        clean_program_run(&run);
+    }
+    unlink(path);
+    return 0;
+}
+
+// :batch
+// `main --jobs N a.cc b.cc ...` runs independent programs on N threads. Each
+// one reports into its own buffer and a failing one unwinds back to run_job,
+// the buffers are printed in argument order once all are done. Only `write`
+// and friends on fd 1 bypass the buffer.
+typedef struct {
+    const char *path;
+    char *output;
+    size_t len;
+    int status;
+} BatchJob;
+List(BatchJobs, BatchJob);
+
+typedef struct {
+    BatchJob *jobs;
+    int cnt;
+    int next; // claimed atomically
+    Options opts;
+} BatchPool;
+
+void run_job(BatchJob *job, Options opts) {
+    FILE *out = open_memstream(&job->output, &job->len);
+    sigjmp_buf jmp;
+    run_ctx = (RunCtx){.out = out, .fail = &jmp};
+    // Half built when compiling failed, clean_program_run frees that too.
+    ProgramRun *run = calloc(1, sizeof(ProgramRun));
+    if (sigsetjmp(jmp, 1) == 0) {
+        compile_program(job->path, opts, run);
+        run_compiled(run);
+        job->status = 0;
+    } else {
+        job->status = run_ctx.status;
+    }
+    clean_program_run(run);
+    release_run();
+    free(run);
+    fclose(out);
+    run_ctx = (RunCtx){0};
+}
+
+void *batch_worker(void *arg) {
+    BatchPool *pool = arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= pool->cnt)
+            return NULL;
+        run_job(&pool->jobs[i], pool->opts);
+    }
+}
+
+int run_batch(BatchJobs jobs, int threads_cnt, Options opts) {
+    BatchPool pool = {jobs.data, jobs.cnt, 0, opts};
+    int workers = jobs.cnt < threads_cnt ? jobs.cnt : threads_cnt;
+    pthread_t *threads = malloc(sizeof(pthread_t) * (workers > 0 ? workers : 1));
+    int started = 0;
+    for (; started < workers - 1; started++) {
+        if (pthread_create(&threads[started], NULL, batch_worker, &pool) != 0)
+            break;
+    }
+    batch_worker(&pool);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    int status = 0;
+    FOR_LIST(jobs) {
+        BatchJob job = VEC_GET(jobs, i);
+        printf("==> %s (exit %d) <==\n", job.path, job.status);
+        fwrite(job.output, 1, job.len, stdout);
+        free(job.output);
+        if (job.status != 0)
+            status = 1;
+    }
+    return status;
+}
+// ;batch
+
+int main(int argc, char **argv) {
+    if (argc < 2)
+        return 1;
+
+    _ *argv++;
+
+    const char *path = *argv++;
+
+    if (strcmp(path, "bench-tokenize") == 0)
+        return bench_tokenize(*argv != NULL ? strtoul(*argv, NULL, 10) : 64);
+    if (strcmp(path, "bench-defines") == 0)
+        return bench_defines(*argv != NULL ? atoi(*argv) : 100000);
+
+    BatchJobs batch = {0};
+    int jobs = 0;
+    if (strcmp(path, "--jobs") == 0) {
+        jobs = *argv != NULL ? atoi(*argv++) : 0;
+        if (jobs <= 0) {
+            printf("Usage: main --jobs <n> <source>... [options]\n");
+            return 1;
+        }
+        path = NULL;
+    }
+
+    bool compile = path != NULL && strcmp(path, "compile") == 0;
+    bool emit = path != NULL && strcmp(path, "emit-c") == 0;
+    if (compile || emit)
+        path = *argv++;
+    const char *out = NULL;
+
+    Options opts = {0};
+    bool gen = false;
+    while (*argv != NULL) {
+        const char *arg = *argv++;
+        if (jobs > 0 && arg[0] != '-') {
+            VEC_ADD(&batch, (BatchJob){.path = arg});
+        } else if (strncmp(arg, "gen", 3) == 0) {
+            gen = true;
+        } else if (strcmp(arg, "-o") == 0 && *argv != NULL) {
+            out = *argv++;
+        } else if (strcmp(arg, "--engine") == 0 && *argv != NULL) {
+            if (!parse_engine(*argv++, &opts.engine))
+                return 1;
+        } else if (strcmp(arg, "--stack-size") == 0 && *argv != NULL) {
+            if (!parse_stack_size(*argv++, arg, &stack_size))
+                return 1;
+        } else if (strcmp(arg, "--backstack-size") == 0 && *argv != NULL) {
+            if (!parse_stack_size(*argv++, arg, &backstack_size))
+                return 1;
+        } else if (strcmp(arg, "--heap") == 0 && *argv != NULL) {
+            if (!parse_heap_size(*argv++, &heap_size))
+                return 1;
+        } else if (strcmp(arg, "--module-cache") == 0 && *argv != NULL) {
+            module_cache_dir = *argv++;
+            if (mkdir(module_cache_dir, 0777) != 0 && errno != EEXIST) {
+                printf("Can't create the module cache %s.\n", module_cache_dir);
+                return 1;
+            }
+        } else if (strcmp(arg, "--jit") == 0) {
+            opts.engine = ENGINE_JIT;
+        } else if (strcmp(arg, "--no-opt") == 0) {
+            opts.no_opt = true;
+        } else if (strcmp(arg, "--stats") == 0) {
+            opts.stats = true;
+        } else if (strcmp(arg, "--profile") == 0 && *argv != NULL) {
+            opts.profile = *argv++;
+        } else if (strcmp(arg, "--stats-json") == 0) {
+            opts.stats = opts.stats_json = true;
+        } else if (strcmp(arg, "--seq-profile") == 0) {
+            opts.seq_profile = true;
+        } else if (strcmp(arg, "--time") == 0) {
+            opts.time = true;
+        } else {
+            printf("Unknown argument %s\n", arg);
+            return 1;
+        }
+    }
+
+    if (jobs > 0) {
+        if (gen || out != NULL || opts.seq_profile || opts.profile != NULL) {
+            printf("--jobs only runs programs.\n");
+            return 1;
+        }
+        int status = run_batch(batch, jobs, opts);
+        VEC_FREE(batch);
+        return status;
+    }
+
+    if (compile) {
+        if (path == NULL || out == NULL) {
+            printf("Usage: main compile <source> -o <image>\n");
+            return 1;
+        }
+        ProgramRun run;
+        compile_program(path, opts, &run);
+        bool ok = write_image(&run, out);
+        clean_program_run(&run);
+        return ok ? 0 : 1;
+    }
+
+    if (emit) {
+        if (path == NULL || out == NULL) {
+            printf("Usage: main emit-c <source> -o <file.c>\n");
+            return 1;
+        }
+        // Images are translated like sources, the same as for gen.
+        ProgramRun run;
+        if (is_image(path)) {
+            if (!load_image(path, &run))
+                return 1;
+            run.opts = opts;
+        } else {
+            compile_program(path, opts, &run);
+        }
+        FILE *f = fopen(out, "w");
+        if (f == NULL) {
+            printf("Can't open %s for writing.\n", out);
+            clean_program_run(&run);
+            return 1;
+        }
+        bool ok = emit_c(&run, f);
+        ok = fclose(f) == 0 && ok;
+        clean_program_run(&run);
+        return ok ? 0 : 1;
+    }
+
+    if (gen && system("cc --version 1> /dev/null") != 0) {
+        printf("No C compiler installed system wide to link with.\n");
+        return 1;
+    }
+
+    if (is_image(path)) {
+        ProgramRun run;
+        if (!load_image(path, &run))
+            return 1;
+        run.opts = opts;
+        bool ok = true;
+        if (gen) {
+            ok = gen_program(&run, out != NULL ? out : "a.out");
+        } else {
+            run_compiled(&run);
+        }
+        clean_program_run(&run);
+        return ok ? 0 : 1;
+    }
+
+    if (gen) {
+        char exe[PATH_MAX];
+        if (out == NULL) {
+            // Next to the source, without the extension.
+            snprintf(exe, sizeof(exe), "%s", path);
+            char *ext = strrchr(exe, '.');
+            if (ext != NULL && strchr(ext, '/') == NULL && ext != exe)
+                *ext = 0;
+            else
+                strncat(exe, ".out", sizeof(exe) - strlen(exe) - 1);
+            out = exe;
+        }
+        ProgramRun run;
+        compile_program(path, opts, &run);
+        bool ok = gen_program(&run, out);
+        clean_program_run(&run);
+        return ok ? 0 : 1;
     }
 
-    ProgramRun run = run_program(path);
+    ProgramRun run = run_program(path, opts);
     clean_program_run(&run);
 
     return 0;
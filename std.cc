@@ -6,7 +6,15 @@
 i64 int def
 
 0 O_RONLY def
+1 O_WRONLY def
+2 O_RDWR def
 
 0 SEEK_SET def
+1 SEEK_CUR def
 2 SEEK_END def
 
+1 PROT_READ def
+2 PROT_WRITE def
+2 MAP_PRIVATE def
+32 MAP_ANONYMOUS def
+
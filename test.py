@@ -1,11 +1,13 @@
 #! /usr/bin/python3
 
 import glob
+import shlex
 import subprocess
 from genericpath import exists
 import sys
 
 concat = "./main"
+engines = ["switch", "threaded", "jit", "tos"]
 
 def check_concat():
     return exists(concat)
@@ -13,29 +15,81 @@ def check_concat():
 def program_has_record(filename):
     return exists(filename + ".out")
 
-def run_program(filename):
+# The arguments of ./main for a test, from <test>.args if there is one. `{}`
+# stands for the test itself, without it the test comes first.
+def program_args(filename):
+    if not exists(filename + ".args"):
+        return [filename]
+    args = shlex.split(open(filename + ".args").read())
+    if "{}" not in args:
+        return [filename] + args
+    return [filename if arg == "{}" else arg for arg in args]
+
+def run_program(filename, options=[]):
     if not program_has_record(filename):
         return False
     run_output = subprocess.run(
-            [concat, filename], 
+            [concat] + program_args(filename) + options,
             stderr=subprocess.PIPE,
             stdout=subprocess.PIPE, 
             check=False, 
             text=True)
     record_output = open(filename + ".out").read()
+    name = " ".join([filename] + options)
     if run_output.stdout == record_output:
-        print(f"> Test {filename} \u001b[32mpassed.\u001b[0m")
+        print(f"> Test {name} \u001b[32mpassed.\u001b[0m")
     else:
-        print(f"> Test {filename} \u001b[31mfailed.\u001b[0m")
+        print(f"> Test {name} \u001b[31mfailed.\u001b[0m")
         print("\u001b[32m=== Expected: ===\u001b[0m")
         print(record_output)
         print("\u001b[31m==== Actual ====\u001b[0m")
         print(run_output.stdout)
     return True
 
+def gen_program(filename, backend):
+    if not program_has_record(filename):
+        return False
+    # Their options only mean something to the interpreter.
+    if exists(filename + ".args"):
+        return True
+    exe = "/tmp/concat_gen_" + filename.replace("/", "_").replace(".", "_")
+    if backend == "c":
+        cmd = [concat, "emit-c", filename, "-o", exe + ".c"]
+    elif backend == "image":
+        # Round trip through `main compile`, the image runs like the source.
+        cmd = [concat, "compile", filename, "-o", exe + ".cco"]
+    else:
+        cmd = [concat, filename, "gen", "-o", exe]
+    gen_output = subprocess.run(
+            cmd,
+            stderr=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            check=False,
+            text=True)
+    output = gen_output.stdout
+    if gen_output.returncode == 0 and backend == "c":
+        subprocess.run(["cc", "-O2", "-w", "-o", exe, exe + ".c"], check=True)
+    if gen_output.returncode == 0:
+        output = subprocess.run(
+                [concat, exe + ".cco"] if backend == "image" else [exe],
+                stderr=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                check=False,
+                text=True).stdout
+    record_output = open(filename + ".out").read()
+    if output == record_output:
+        print(f"> Gen {backend} {filename} \u001b[32mpassed.\u001b[0m")
+    else:
+        print(f"> Gen {backend} {filename} \u001b[31mfailed.\u001b[0m")
+        print("\u001b[32m=== Expected: ===\u001b[0m")
+        print(record_output)
+        print("\u001b[31m==== Actual ====\u001b[0m")
+        print(output)
+    return True
+
 def record_program(filename):
     run_output = subprocess.run(
-            ["./main", filename], 
+            [concat] + program_args(filename),
             stderr=subprocess.PIPE,
             stdout=subprocess.PIPE, 
             check=False, 
@@ -73,6 +127,17 @@ if __name__ == "__main__":
                     print(f"Run of single program {filename} doesn't have a record")
             else:
                 print("Usage: test.py s <filename>. Not enought arguments")
+        elif arg == "g" or arg == "c" or arg == "i":
+            backend = {"c": "c", "i": "image"}.get(arg, "asm")
+            print(f"Running all tests and examples through the {backend} backend:")
+            for filename in glob.glob("./tests/*.cc") + glob.glob("./examples/*.cc"):
+                gen_program(filename, backend)
+        elif arg == "e":
+            print("Running all tests and examples on every engine, with and without the optimizer:")
+            for filename in glob.glob("./tests/*.cc") + glob.glob("./examples/*.cc"):
+                for engine in engines:
+                    run_program(filename, ["--engine", engine])
+                    run_program(filename, ["--engine", engine, "--no-opt"])
         elif arg == "r":
             if argc >= 3:
                 filename = sys.argv[2]
@@ -0,0 +1,5 @@
+// freed blocks are handed out again
+16 malloc . free 16 malloc = sout 10 putc
+
+// arena_reset frees every block at once
+32 malloc , 5000 malloc , arena_reset
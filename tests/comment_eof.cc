@@ -0,0 +1,2 @@
+1 sout 10 putc
+// a comment at the end of the file
\ No newline at end of file
@@ -0,0 +1,5 @@
+// Every run reaches the `+` after the endif, whichever way the if goes, so
+// the underflow is reported before anything runs.
+"hi" println
+0 if 1 sout endif
+1 +
@@ -0,0 +1,4 @@
+// Branches that leave different depths aren't rejected, the program runs
+// checked and fails where it actually goes wrong.
+1 if 7 endif sout 10 putc
+0 if 7 endif sout 10 putc
@@ -0,0 +1,6 @@
+// A loop that changes the stack isn't rejected, the program runs checked and
+// only fails once it actually overflows.
+5 loop . 0 ; > do . 1 ; - end ? ,,,,,,
+0 loop . 10 > do
+	1 + 1
+end
@@ -0,0 +1,5 @@
+// Runs with --heap 64, 32 bytes fit but 64 more don't.
+32 small_size def
+64 big_size def
+small_size small mem
+big_size big mem
@@ -0,0 +1,7 @@
+"./tests/module.cc" include
+"./std.cc" include
+"./tests/module.cc" include
+
+GREETING print 10 putc
+41 counter w64_mem
+i64 counter deref 1 + sout 10 putc
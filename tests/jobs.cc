@@ -0,0 +1,2 @@
+// Runs next to two other programs with --jobs, each reports on its own.
+1 2 + sout 10 putc
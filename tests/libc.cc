@@ -0,0 +1,15 @@
+"./std.cc" include
+
+i64 fd mem
+i64 buf mem
+
+O_RONLY "./examples/test.txt" open fd w64_mem
+
+0 0 MAP_PRIVATE MAP_ANONYMOUS + PROT_READ PROT_WRITE + 4096 0 mmap buf w64_mem
+
+// pread 7 bytes at offset 3 into the mapping, it returns how many it read
+3 7 i64 buf deref i64 fd deref pread sout 10 putc
+7 i64 buf deref as_str println
+
+4096 i64 buf deref munmap
+i64 fd deref close
@@ -0,0 +1,7 @@
+// Included by include_once.cc, only its defines are merged.
+"./std.cc" include
+
+"greetings from a module" GREETING def
+i64 counter mem
+
+"module ran" print 10 putc
@@ -0,0 +1,22 @@
+"./std.cc" include
+
+// Arithmetic wraps around at 32 bits the same way on every backend.
+i64 x mem
+2147483647 x w64_mem
+
+i64 x deref 1 + sout 10 putc
+i64 x deref 0 - 3 ; - sout 10 putc
+i64 x deref . * sout 10 putc
+i64 x deref 1 + 2 ; / sout 10 putc
+1234567 loop . 0 < do
+	i64 x deref 7 * 13 + x w64_mem
+	1 ; -
+end ,
+i64 x deref sout 10 putc
+
+// Counts the i for which i + 2147483600 is still positive, a compiler that
+// assumed no overflow would count all 100.
+0 100 loop . 0 < do
+	. 2147483600 + 0 < if ; 1 + ; endif
+	1 ; -
+end , sout 10 putc
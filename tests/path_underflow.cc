@@ -0,0 +1,6 @@
+// The first `+` only underflows when its if is taken, so the program isn't
+// rejected before running. It runs checked and fails once it gets there.
+"hi" println
+0 if 1 + endif
+"still here" println
+1 if 1 + endif
@@ -0,0 +1,2 @@
+// --profile writes its files and leaves the output alone.
+0 loop . 3 > do . sout 10 putc 1 + end ,
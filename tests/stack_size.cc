@@ -0,0 +1,4 @@
+// Runs with --stack-size 4. Three values fit, the fourth doesn't and the
+// verifier rejects it before anything runs.
+1 2 3 sout sout sout 10 putc
+1 2 3 4
@@ -0,0 +1,2 @@
+// --stats counts on the switch loop, the program still runs the same.
+0 loop . 5 > do . sout 32 putc 1 + end , 10 putc
@@ -0,0 +1,2 @@
+// --stats-json reports on stderr, the output stays the same.
+"json" println 6 7 * sout 10 putc
@@ -0,0 +1,8 @@
+// `w_mem` stores like `w64_mem`, at the offset a `mem` name stands for.
+8 cell def
+cell a mem
+cell b mem
+7 a w_mem
+9 b w_mem
+8 a deref sout 10 putc
+8 b deref sout 10 putc